@@ -6,19 +6,18 @@
 
 #include "macrolyze.h"
 #include "16bitcolours.h"
-#include "addresses.h"
 #include "brightness.h"
+#include "frame.h"
 #include "keypad.h"
 #include "lcd.h"
 #include "macros.h"
 #include "memory.h"
 #include "rgbled.h"
+#include "settings.h"
 #include "timer.h"
 #include "usart.h"
-#include <avr/interrupt.h>
-#include <avr/io.h>
+#include "hal.h"
 #include <stdio.h>
-#include <util/delay.h>
 
 // Global variable for brightness level and autoBrightnessMode for easy
 // access to interrupt.
@@ -28,23 +27,30 @@ uint8_t autoBrightnessMode;
 // Global variable for interrupt to specify the transfer mode.
 uint8_t transferMode;
 
-// Global variable array for interrupt to store all received configuration
-// data.
-uint8_t data[RECEIVE_BUFFER];
-uint16_t counter; // Stores index of last byte in data array.
+// Global variables for interrupt to decode configuration frames. Keys are
+// kept by macros.c and settings in configData until stored.
+uint8_t configField; // Letter of the field being received, 0 between fields.
+uint8_t configIndex; // Index of the next byte of the field.
+uint8_t configReceived; // Bitmap of the settings received.
+uint8_t configData[CONFIG_LENGTH];
+uint8_t configFull; // Macro data of the frame does not fit in EEPROM.
+
+// Time in ms from power up until keys were first handled and until the LCD
+// had started, sent to GUI to keep track of start up time.
+uint16_t readyTime;
+uint16_t lcdReadyTime;
 
 int main(void)
 {
     transferMode = 0;
-    counter = 0;
 
     // Initialise USART.
     usartInit(UBRR);
 
-    // Initialise LCD.
+    // Initialise LCD, which is started by the main loop.
     lcdInit();
     uint8_t connected = 0;
-    fillScreen(BLACK, connected);
+    uint8_t lcdStarted = 0;
 
     // Initialise LEDS.
     ledInit();
@@ -56,17 +62,21 @@ int main(void)
 
     // Initialise initial brightness level.
     initAutoBrightness();
+    initSettings();
     brightnessLevel = 5;
     autoBrightnessMode = 0;
-    brightnessLevel = eepromRead((uint16_t)BRIGHTNESS_ADDRESS);
-    autoBrightnessMode = eepromRead((uint16_t)AUTOBRIGHT_ADDRESS);
+    brightnessLevel = getSetting(SETTING_BRIGHTNESS);
+    autoBrightnessMode = getSetting(SETTING_AUTO_BRIGHTNESS);
 
     // Initialise variables to determine when to update LCD with brightness.
     uint8_t initialBrightnessLevel = brightnessLevel;
     uint8_t displayBrightness = 0;
-    uint8_t brightnessKeyPressed = 0;
     uint32_t lastUpdateTime;
 
+    // Initialise variables to store brightness once the key is left alone.
+    uint8_t brightnessChanged = 0;
+    uint32_t brightnessTime = 0; // Time of the last brightness key press.
+
     // Initialise Keypad.
     keyPadInit();
 
@@ -74,103 +84,119 @@ int main(void)
     macrosInit();
     uint8_t previewMode = 0;
 
-    // Initialise variable for storing current keypress.
-    uint8_t* keyPressed;
+    // Initialise variables for storing the state of every key. Bitmaps and
+    // arrays are indexed by KEY_INDEX().
+    uint16_t keysDown = 0; // Keys currently held down.
+    uint16_t repeatKeys = 0; // Keys held past their 'initial repeat delay'.
+    uint32_t keyTime[KEYS]; // Time of the press or last repeat of each key.
     uint8_t matrixLocation[2];
     uint8_t initKeyCol = IGNORE_PRESS;
     uint8_t initKeyRow = IGNORE_PRESS;
 
     // Initialise variables for 'initial repeat delay'.
-    uint8_t initialPress = 0;
-    uint32_t initialPressTime = 0;
     uint16_t initialRepeatDelay = 0;
-    initialRepeatDelay = (eepromRead((uint16_t)INIT_REPEAT_DELAY_ADDRESS) << 8)
-        | eepromRead((uint16_t)INIT_REPEAT_DELAY_ADDRESS + 1);
+    initialRepeatDelay = getSetting(SETTING_INITIAL_DELAY);
 
     // Initialise variables for 'repeat rate'.
-    uint8_t repeatPress = 0;
-    uint32_t repeatPressTime = 0;
     uint16_t repeatPressDelay = 0;
-    repeatPressDelay = (eepromRead((uint16_t)REPEAT_RATE_ADDRESS) << 8)
-        | eepromRead((uint16_t)REPEAT_RATE_ADDRESS + 1);
+    repeatPressDelay = getSetting(SETTING_REPEAT_RATE);
 
-    uint8_t ledBlinkOff = 0;
-    uint32_t ledOffTime = 0;
-
-    uint8_t ledBlinkOn = 0;
-    uint32_t ledOnTime = 0;
+    // Initialise variables for blinking the LED of each key.
+    uint16_t ledBlinkOff = 0; // Keys with LED turned off for a blink.
+    uint16_t ledBlinkOn = 0; // Repeating keys with LED on between blinks.
+    uint32_t ledTime[KEYS]; // Time the LED of each key last changed.
     uint8_t blinkOnce = 0;
 
+    // Read macro data from EEPROM before a frame from GUI can replace it.
+    getMacroData();
+
     // Enable global interrupts.
     sei();
 
-    // Display team number and course code for 2 seconds.
-    drawText("Team 01", 45, 45);
-    drawText("ENGG2800", 39, 65);
+    // Move settings out of the EEPROM addresses the macro image reuses.
+    moveSettings();
+
+    // Initialise variables for the start screen, shown by the main loop once
+    // the LCD has started.
+    uint8_t startScreen = 0;
+    uint32_t startScreenTime = 0;
     lastUpdateTime = getCurrentTime();
-    while (1) {
-        if (getCurrentTime() >= lastUpdateTime + START_SCREEN_DELAY) {
-            fillScreen(BLACK, connected);
-            lastUpdateTime = getCurrentTime();
-            break;
-        }
-    }
 
-    // Read macro data from EEPROM.
-    getMacroData();
     if (!autoBrightnessMode)
         setBrightness(brightnessLevel);
 
-    while (1) {
-        if (transferMode == RECEIVE_MODE) {
-            // Wait 1 second for transfer to complete.
-            uint32_t startTransferTime = getCurrentTime();
-            while (getCurrentTime() < startTransferTime + RECEIVE_DELAY) { }
-
-            cli();
-
-            // Decode data to get macro data and update counter to
-            // decode other configuration data.
-            counter = receiveMacroData(data);
+    // Keys are handled from here on, record when for the GUI.
+    readyTime = getCurrentTime();
 
-            // Get initial repeat delay.
-            counter++;
-            uint8_t high = data[counter++];
-            uint8_t low = data[counter++];
-            initialRepeatDelay = (high << 8) | low;
-
-            // Get repeat rate.
-            counter++;
-            high = data[counter++];
-            low = data[counter++];
-            repeatPressDelay = (high << 8) | low;
-
-            // Get auto brightness mode.
-            counter++;
-            autoBrightnessMode = data[counter++];
+    while (1) {
+        // Time at the start of this pass of the main loop.
+        uint32_t now = getCurrentTime();
+
+        // Store or undo a configuration frame as soon as it has ended.
+        uint8_t frame = frameResult();
+        if (frame) {
+            uint8_t sequence = frameSequence();
+            uint8_t applied = 0;
+            uint8_t full = configFull;
+
+            // Count only the bytes programmed for this frame.
+            eepromBytesWritten();
+            if (frame == FRAME_DONE && !configField) {
+                applied = applyConfig(&initialRepeatDelay, &repeatPressDelay);
+                full = !applied;
+            }
 
-            // Get brightness level.
-            counter++;
-            brightnessLevel = data[counter++];
+            // Put back keys already received from a rejected frame.
+            if (!applied)
+                discardMacroData();
+            colourChanged = 1;
+
+            if (applied || frame == FRAME_REPEAT) {
+                // A repeated frame was sent again because the reply was lost.
+                // Only acknowledge once the frame is safe in EEPROM, and
+                // report how many bytes it changed.
+                eepromFlush();
+                uint16_t written = eepromBytesWritten();
+                usartTransmit(FRAME_ACK);
+                usartTransmit(sequence);
+                usartTransmit(written >> 8);
+                usartTransmit(written);
+            } else {
+                // Tell GUI apart a frame that is too big from a damaged one.
+                usartTransmit(full ? FRAME_FULL : FRAME_NAK);
+            }
+            frameRelease(applied);
 
-            storeAllData(initialRepeatDelay, repeatPressDelay);
+            initKeyCol = IGNORE_PRESS;
+            initKeyRow = IGNORE_PRESS;
+            blinkOnce = 0;
+        }
 
-            if (!autoBrightnessMode)
-                setBrightness(brightnessLevel);
+        // Display team number and course code for 2 seconds once the LCD has
+        // started, unless something else is displayed first.
+        if (!lcdStarted && lcdReady()) {
+            lcdStarted = 1;
+            lcdReadyTime = now;
+            fillScreen(BLACK, connected);
+            drawText(TEXT_FIRST, "Team 01", 45, 45);
+            drawText(TEXT_SECOND, "ENGG2800", 39, 65);
+            startScreen = 1;
+            startScreenTime = now;
+        }
+        if (startScreen && now >= startScreenTime + START_SCREEN_DELAY) {
+            clearText();
+            startScreen = 0;
+        }
 
-            counter = 0;
+        if (transferMode == RECEIVE_ERROR) {
+            usartTransmit(FRAME_NAK);
             transferMode = 0;
-            initKeyCol = IGNORE_PRESS;
-            initKeyRow = IGNORE_PRESS;
-            sei();
         }
 
         // Send macro data to GUI.
         if (transferMode == SEND_MODE) {
-            cli();
             sendMacroData();
             transferMode = 0;
-            sei();
         }
 
         if (transferMode == SOFTWARE_CONNECTED) {
@@ -187,68 +213,110 @@ int main(void)
 
         // Send repeat rate to GUI.
         if (transferMode == SEND_REPEAT_RATE) {
-            cli();
             usartTransmit('R');
             uint8_t highRepeat = repeatPressDelay >> 8;
             uint8_t lowRepeat = repeatPressDelay;
             usartTransmit(highRepeat);
             usartTransmit(lowRepeat);
-            sei();
             transferMode = 0;
         }
 
         // Send initial repeat delay to GUI.
         if (transferMode == SEND_INITIAL_REPEAT_DELAY) {
             // Send initial repeat delay.
-            cli();
             usartTransmit('D');
             uint8_t highDelay = initialRepeatDelay >> 8;
             uint8_t lowDelay = initialRepeatDelay;
             usartTransmit(highDelay);
             usartTransmit(lowDelay);
-            sei();
             transferMode = 0;
         }
 
-        // Check if any key is pressed.
-        keyPressed = keyPress(matrixLocation);
-
-        // Bring device and LED back to default state if no key is pressed.
-        if (keyPressed[COL] == IGNORE_PRESS) {
-            initialPress = 0;
-            repeatPress = 0;
-            brightnessKeyPressed = 0;
-            for (uint8_t col = 0; col < COLS; col++) {
-                for (uint8_t row = 0; row < ROWS; row++)
-                    turnOnLed(col, row);
+        // Send brightness level to GUI.
+        if (transferMode == SEND_BRIGHTNESS) {
+            usartTransmit('B');
+            usartTransmit(brightnessLevel);
+            transferMode = 0;
+        }
+
+        // Send the time in ms from power up until keys were handled and until
+        // the LCD started (0 if it has not yet) to GUI.
+        if (transferMode == SEND_START_TIME) {
+            usartTransmit('T');
+            usartTransmit(readyTime >> 8);
+            usartTransmit(readyTime);
+            usartTransmit(lcdReadyTime >> 8);
+            usartTransmit(lcdReadyTime);
+            transferMode = 0;
+        }
+
+        // Send the pacing of every key and the HID report rate to GUI.
+        if (transferMode == SEND_PACING) {
+            sendMacroPacing();
+            transferMode = 0;
+        }
+
+        // Send how often macro names were laid out and shown.
+        if (transferMode == SEND_NAME_LAYOUTS) {
+            sendNameLayouts();
+            transferMode = 0;
+        }
+
+        // Send how much of the macro image is used.
+        if (transferMode == SEND_IMAGE_SIZE) {
+            sendImageSize();
+            transferMode = 0;
+        }
+
+        // Send auto brightness mode to GUI.
+        if (transferMode == SEND_AUTO_BRIGHTNESS) {
+            usartTransmit('A');
+            if (autoBrightnessMode) {
+                usartTransmit(1);
+            } else {
+                usartTransmit(0);
             }
+            transferMode = 0;
         }
 
-        // Check if key is pressed.
-        if (keyPressed[COL] != IGNORE_PRESS && !initialPress) {
+        // Handle every debounced key event queued since the last pass.
+        uint8_t event;
+        while ((event = keyEvent(matrixLocation)) != NO_KEY_EVENT) {
+            uint8_t col = matrixLocation[COL];
+            uint8_t row = matrixLocation[ROW];
+            uint8_t index = KEY_INDEX(col, row);
+            uint16_t key = 1 << index;
+
+            // Bring key and its LED back to default state when released.
+            if (event == KEY_RELEASED) {
+                keysDown &= ~key;
+                repeatKeys &= ~key;
+                ledBlinkOn &= ~key;
+                continue;
+            }
+            keysDown |= key;
+            keyTime[index] = now;
+
             // Check if brightness key was pressed.
-            if (keyPressed[COL] == 2 && keyPressed[ROW] == 2) {
+            if (col == 2 && row == 2) {
                 if (autoBrightnessMode) {
                     autoBrightnessMode = 0;
                     brightnessLevel = 0;
-                    eepromWrite((uint16_t)AUTOBRIGHT_ADDRESS, autoBrightnessMode);
-                    eepromWrite((uint16_t)BRIGHTNESS_ADDRESS, brightnessLevel);
                 } else if (brightnessLevel == 9) {
                     autoBrightnessMode = 1;
                     if (displayBrightness) {
-                        fillScreen(BLACK, connected);
+                        clearText();
                         displayBrightness = 0;
                     }
-                    eepromWrite((uint16_t)AUTOBRIGHT_ADDRESS, autoBrightnessMode);
                 } else {
                     brightnessLevel++;
-                    eepromWrite((uint16_t)BRIGHTNESS_ADDRESS, brightnessLevel);
                 }
-                brightnessKeyPressed = 1;
+                brightnessChanged = 1;
+                brightnessTime = now;
             }
 
             // Check if preview mode key was pressed.
-            if (keyPressed[COL] == 3 && keyPressed[ROW] == 2) {
+            if (col == 3 && row == 2) {
                 if (previewMode) {
                     previewMode = 0;
                     setMacroNumActions(3, 2, 0);
@@ -260,93 +328,100 @@ int main(void)
                 }
             }
 
-            if (!previewMode && !brightnessKeyPressed) {
-                executeMacro(keyPressed[COL], keyPressed[ROW]);
-                ledBlinkOff = 1;
-                ledOffTime = getCurrentTime();
+            if (!previewMode && !(col == 2 && row == 2)) {
+                executeMacro(col, row);
+                turnOffLed(col, row);
+                colourChanged = 1;
+                ledBlinkOff |= key;
+                ledTime[index] = now;
             }
 
-            initialPress = 1;
-            initialPressTime = getCurrentTime();
-
             // Check if the macro name displayed on LCD was same as previous.
-            if (initKeyCol != keyPressed[COL] || initKeyRow != keyPressed[ROW]) {
+            if (initKeyCol != col || initKeyRow != row) {
                 blinkOnce = 1;
-                initKeyCol = keyPressed[COL];
-                initKeyRow = keyPressed[ROW];
+                initKeyCol = col;
+                initKeyRow = row;
             }
         }
-
-        // Check if key is held for 'initial repeat delay'.
-        if (keyPressed[COL] != IGNORE_PRESS && initialPress && !repeatPress) {
-            if (getCurrentTime() >= initialPressTime + initialRepeatDelay) {
-                if (!previewMode && !brightnessKeyPressed) {
-                    executeMacro(keyPressed[COL], keyPressed[ROW]);
-                    ledBlinkOff = 1;
-                    ledOffTime = getCurrentTime();
+        uint8_t brightnessKeyPressed = (keysDown & (1 << KEY_INDEX(2, 2))) != 0;
+
+        // Check if any key is held for 'initial repeat delay' or, once
+        // repeating, for 'repeat rate'.
+        for (uint8_t index = 0; index < KEYS; index++) {
+            uint16_t key = 1 << index;
+            if (!(keysDown & key))
+                continue;
+
+            uint16_t delay = initialRepeatDelay;
+            if (repeatKeys & key)
+                delay = repeatPressDelay;
+            if (now < keyTime[index] + delay)
+                continue;
+
+            uint8_t col = index / ROWS;
+            uint8_t row = index % ROWS;
+            if (!previewMode && !(col == 2 && row == 2)) {
+                executeMacro(col, row);
+                if (!(repeatKeys & key)) {
+                    turnOffLed(col, row);
+                    colourChanged = 1;
+                    ledBlinkOff |= key;
+                    ledTime[index] = now;
                 }
-                repeatPress = 1;
-                repeatPressTime = getCurrentTime();
             }
+            repeatKeys |= key;
+            keyTime[index] = now;
         }
 
-        // Check if key is held for 'repeat rate'.
-        if (keyPressed[COL] != IGNORE_PRESS && repeatPress) {
-            if (getCurrentTime() >= repeatPressTime + repeatPressDelay) {
-                if (!previewMode && !brightnessKeyPressed)
-                    executeMacro(keyPressed[COL], keyPressed[ROW]);
-                repeatPressTime = getCurrentTime();
-            }
-        }
+        // Send the next HID report of all running macros.
+        runMacros();
 
-        // Update colour and brightness.
-        if (colourChanged) {
-            setBrightness(brightnessLevel);
-            colourChanged = 0;
-        }
-
-        // Blink LED every 50ms if key is pressed.
-        if (ledBlinkOff) {
-            turnOffLed(keyPressed[COL], keyPressed[ROW]);
-            setBrightness(brightnessLevel);
+        // Blink LED for 50ms when its macro is executed and keep blinking
+        // while the key is in repeat mode.
+        for (uint8_t index = 0; index < KEYS; index++) {
+            uint16_t key = 1 << index;
+            uint8_t col = index / ROWS;
+            uint8_t row = index % ROWS;
 
-            if (getCurrentTime() >= ledOffTime + LED_BLINK_DELAY) {
-                turnOnLed(keyPressed[COL], keyPressed[ROW]);
-                setBrightness(brightnessLevel);
-                ledBlinkOff = 0;
+            if ((ledBlinkOff & key) && now >= ledTime[index] + LED_BLINK_DELAY) {
+                turnOnLed(col, row);
+                colourChanged = 1;
+                ledBlinkOff &= ~key;
+                if (repeatKeys & key)
+                    ledBlinkOn |= key;
+                ledTime[index] = now;
 
                 // Display macro name on LCD after LED is blinked to avoid
                 // input delay to macro.
-                if (blinkOnce) {
-                    if (keyPressed[COL] != 3 || keyPressed[ROW] != 2) {
-                        fillScreen(BLACK, connected);
-                        displayMacroName(keyPressed[COL], keyPressed[ROW]);
+                if (blinkOnce && col == initKeyCol && row == initKeyRow) {
+                    if (col != 3 || row != 2) {
+                        displayMacroName(col, row);
+                        startScreen = 0;
                     }
                     blinkOnce = 0;
                 }
-
-                if (repeatPress)
-                    ledBlinkOn = 1;
-                ledOnTime = getCurrentTime();
+            } else if ((ledBlinkOn & key)
+                && now >= ledTime[index] + repeatPressDelay) {
+                ledBlinkOn &= ~key;
+                turnOffLed(col, row);
+                colourChanged = 1;
+                ledBlinkOff |= key;
+                ledTime[index] = now;
             }
         }
 
-        // Keep LED On for 50ms if key is in repeat mode.
-        if (ledBlinkOn) {
-            if (getCurrentTime() >= ledOnTime + repeatPressDelay) {
-                ledBlinkOn = 0;
-                if (repeatPress)
-                    ledBlinkOff = 1;
-                ledOffTime = getCurrentTime();
-            }
+        // Update colour and brightness.
+        if (colourChanged) {
+            setBrightness(brightnessLevel);
+            colourChanged = 0;
         }
 
         // Display macro name if preview mode is on.
         if (previewMode) {
             if (blinkOnce) {
-                if (keyPressed[COL] != 3 || keyPressed[ROW] != 2) {
-                    fillScreen(BLACK, connected);
-                    displayMacroName(keyPressed[COL], keyPressed[ROW]);
+                if (initKeyCol != 3 || initKeyRow != 2) {
+                    displayMacroName(initKeyCol, initKeyRow);
+                    startScreen = 0;
                 }
                 blinkOnce = 0;
             }
@@ -368,51 +443,156 @@ int main(void)
             if (!brightnessKeyPressed) {
                 initKeyCol = IGNORE_PRESS;
                 initKeyRow = IGNORE_PRESS;
+                blinkOnce = 0;
             }
             setBrightness(brightnessLevel);
-            fillScreen(BLACK, connected);
-            drawText("Brightness: ", 10, 55);
-            char buffer[NUMBER_BUFFER];
-            sprintf(buffer, "%d", brightnessLevel);
-            drawText(buffer, 135, 55);
+            // Only the level is redrawn while the brightness is shown.
+            char buffer[MAX_TEXT + 1];
+            sprintf(buffer, "Brightness: %d", brightnessLevel);
+            drawText(TEXT_SECOND, "", 0, 0);
+            drawText(TEXT_FIRST, buffer, 10, 55);
             displayBrightness = 1;
+            startScreen = 0;
             initialBrightnessLevel = brightnessLevel;
             lastUpdateTime = getCurrentTime();
         }
 
+        // Store brightness settings once the brightness key has been left
+        // alone, so several presses in a row are written once.
+        if (brightnessChanged && now >= brightnessTime + BRIGHTNESS_STORE_DELAY) {
+            storeSetting(SETTING_AUTO_BRIGHTNESS, autoBrightnessMode);
+            if (!autoBrightnessMode)
+                storeSetting(SETTING_BRIGHTNESS, brightnessLevel);
+            brightnessChanged = 0;
+        }
+
         // Display brightness level for 1 second.
         if (displayBrightness) {
             if (getCurrentTime() >= lastUpdateTime + DISPLAY_BRIGHTNESS_DELAY) {
-                fillScreen(BLACK, connected);
+                clearText();
                 initialBrightnessLevel = brightnessLevel;
                 displayBrightness = 0;
             }
         }
+
+        // Draw the next part of what is waiting to be shown on the LCD.
+        lcdService();
     }
 
     return 0;
 }
 
-/* storeAllData()
- * --------------
- * Stores all configuration data to EEPROM.
+/* receiveConfigByte()
+ * -------------------
+ * Decodes the next byte of the payload of a frame from GUI. Called from the
+ * USART receive interrupt. The payload is any number of fields, each a letter
+ * and its data: a whole key or one field of a key (see receiveMacroByte()),
+ * 'D' and the initial repeat delay, 'R' and the repeat rate (2 bytes each),
+ * 'A' and the auto brightness mode, or 'B' and the brightness level. So the
+ * GUI can send the whole configuration or just what was edited.
+ *
+ * byte: the byte received.
+ *
+ * Returns: 1 if the byte was decoded or 0 if the payload is malformed or its
+ *     macro data does not fit.
+ */
+uint8_t receiveConfigByte(uint8_t byte)
+{
+    if (!configField) {
+        // Start a new field.
+        configField = byte;
+        configIndex = 0;
+        if (byte == MACRO_KEY || byte == MACRO_NAME || byte == MACRO_COLOUR
+            || byte == MACRO_ACTIONS || byte == MACRO_PACING)
+            receiveMacroStart(byte);
+        else if (byte != 'D' && byte != 'R' && byte != 'A' && byte != 'B')
+            return 0;
+    }
+
+    if (configField != 'D' && configField != 'R' && configField != 'A'
+        && configField != 'B') {
+        uint8_t macro = receiveMacroByte(byte);
+        if (macro == MACRO_DONE)
+            configField = 0;
+        if (macro == MACRO_FULL)
+            configFull = 1;
+        return macro == MACRO_BUSY || macro == MACRO_DONE;
+    }
+
+    // Settings are kept until the frame is stored.
+    uint8_t index = configIndex++;
+    if (index == 0)
+        return 1;
+
+    uint8_t setting;
+    if (configField == 'D') {
+        setting = CONFIG_INITIAL_DELAY;
+        configData[setting + index - 1] = byte;
+        if (index < 2)
+            return 1;
+    } else if (configField == 'R') {
+        setting = CONFIG_REPEAT_RATE;
+        configData[setting + index - 1] = byte;
+        if (index < 2)
+            return 1;
+    } else if (configField == 'A') {
+        setting = CONFIG_AUTO_BRIGHTNESS;
+        if (byte > 1)
+            return 0;
+        configData[setting] = byte;
+    } else {
+        setting = CONFIG_BRIGHTNESS;
+        if (byte > 9)
+            return 0;
+        configData[setting] = byte;
+    }
+
+    configReceived |= (1 << setting);
+    configField = 0;
+    return 1;
+}
+
+/* applyConfig()
+ * -------------
+ * Applies and stores to EEPROM the settings and macro data received in a
+ * frame from GUI. Only what was received is written. Nothing is applied if
+ * the macro data does not fit in EEPROM.
+ *
+ * initialRepeatDelay: a pointer to the initial repeat delay to update.
+ * repeatPressDelay: a pointer to the repeat rate to update.
  *
- * initialRepeatDelay: the initial repeat delay value to store.
- * repeatPressDelay: the repeat rate value to store.
+ * Returns: 1 if the frame was applied, otherwise 0.
  */
-void storeAllData(uint16_t initialRepeatDelay, uint16_t repeatPressDelay)
+uint8_t applyConfig(uint16_t* initialRepeatDelay, uint16_t* repeatPressDelay)
 {
-    eepromWrite((uint16_t)INIT_REPEAT_DELAY_ADDRESS, initialRepeatDelay >> 8);
-    eepromWrite((uint16_t)INIT_REPEAT_DELAY_ADDRESS + 1, initialRepeatDelay);
+    if (!storeMacroData())
+        return 0;
 
-    eepromWrite((uint16_t)REPEAT_RATE_ADDRESS, repeatPressDelay >> 8);
-    eepromWrite((uint16_t)REPEAT_RATE_ADDRESS + 1, repeatPressDelay);
+    if (configReceived & (1 << CONFIG_INITIAL_DELAY)) {
+        *initialRepeatDelay = (configData[CONFIG_INITIAL_DELAY] << 8)
+            | configData[CONFIG_INITIAL_DELAY + 1];
+        storeSetting(SETTING_INITIAL_DELAY, *initialRepeatDelay);
+    }
 
-    eepromWrite((uint16_t)BRIGHTNESS_ADDRESS, brightnessLevel);
+    if (configReceived & (1 << CONFIG_REPEAT_RATE)) {
+        *repeatPressDelay = (configData[CONFIG_REPEAT_RATE] << 8)
+            | configData[CONFIG_REPEAT_RATE + 1];
+        storeSetting(SETTING_REPEAT_RATE, *repeatPressDelay);
+    }
 
-    eepromWrite((uint16_t)AUTOBRIGHT_ADDRESS, autoBrightnessMode);
+    if (configReceived & (1 << CONFIG_BRIGHTNESS)) {
+        brightnessLevel = configData[CONFIG_BRIGHTNESS];
+        storeSetting(SETTING_BRIGHTNESS, brightnessLevel);
+    }
+
+    if (configReceived & (1 << CONFIG_AUTO_BRIGHTNESS)) {
+        autoBrightnessMode = configData[CONFIG_AUTO_BRIGHTNESS];
+        storeSetting(SETTING_AUTO_BRIGHTNESS, autoBrightnessMode);
+    }
 
-    storeMacroData();
+    if (!autoBrightnessMode)
+        setBrightness(brightnessLevel);
+    return 1;
 }
 
 // Interrupt for receiving bytes through USART.
@@ -421,19 +601,30 @@ ISR(USART_RX_vect)
     uint8_t input;
     input = UDR0;
 
-    // Store all bytes received into data array.
-    if (transferMode == RECEIVE_MODE) {
-        data[counter++] = input;
+    // Decode configuration frames as they arrive, the main program stores
+    // them once complete.
+    uint8_t frame = frameReceive(input);
+    if (frame == FRAME_BEGIN) {
+        configField = 0;
+        configReceived = 0;
+        configFull = 0;
         return;
     }
 
-    if (input == 'M') {
-        // Initiate data transfer.
-        transferMode = RECEIVE_MODE;
-        data[counter++] = input;
+    if (frame == FRAME_DATA) {
+        if (!receiveConfigByte(input))
+            frameAbort();
         return;
     }
 
+    if (frame == FRAME_ERROR) {
+        transferMode = RECEIVE_ERROR;
+        return;
+    }
+
+    if (frame != FRAME_NONE)
+        return;
+
     if (input == 'm') {
         // Send all macro data through USART.
         transferMode = SEND_MODE;
@@ -463,18 +654,32 @@ ISR(USART_RX_vect)
     }
 
     if (input == 'b') {
-        usartTransmit('B');
-        usartTransmit(brightnessLevel);
+        transferMode = SEND_BRIGHTNESS;
         return;
     }
 
     if (input == 'a') {
-        usartTransmit('A');
-        if (autoBrightnessMode) {
-            usartTransmit(1);
-        } else {
-            usartTransmit(0);
-        }
+        transferMode = SEND_AUTO_BRIGHTNESS;
+        return;
+    }
+
+    if (input == 't') {
+        transferMode = SEND_START_TIME;
+        return;
+    }
+
+    if (input == 'p') {
+        transferMode = SEND_PACING;
+        return;
+    }
+
+    if (input == 'l') {
+        transferMode = SEND_NAME_LAYOUTS;
+        return;
+    }
+
+    if (input == 's') {
+        transferMode = SEND_IMAGE_SIZE;
         return;
     }
 }
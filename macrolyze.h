@@ -11,19 +11,36 @@
 #define F_CPU 11059200L
 
 // Transfer modes.
-#define RECEIVE_MODE 1
 #define SEND_MODE 2
 #define SOFTWARE_CONNECTED 3
 #define SOFTWARE_DISCONNECTED 4
 #define SEND_REPEAT_RATE 5
 #define SEND_INITIAL_REPEAT_DELAY 6
+#define SEND_BRIGHTNESS 7
+#define SEND_AUTO_BRIGHTNESS 8
+#define RECEIVE_ERROR 9
+#define SEND_START_TIME 10
+#define SEND_PACING 11
+#define SEND_NAME_LAYOUTS 12
+#define SEND_IMAGE_SIZE 13
 
 // Time delays to compare with getCurrentTime().
 #define START_SCREEN_DELAY 2000
 #define DISPLAY_BRIGHTNESS_DELAY 1000
 #define LED_BLINK_DELAY 50
-#define RECEIVE_DELAY 1000
 #define AUTO_BRIGHTNESS_DELAY 200
+#define BRIGHTNESS_STORE_DELAY 1000
 
-// Stores all configuration data on EEPROM.
-void storeAllData(uint16_t initialRepeatDelay, uint16_t repeatPressDelay);
\ No newline at end of file
+// Index of each setting received from GUI in configData, also its bit in
+// configReceived.
+#define CONFIG_INITIAL_DELAY 0
+#define CONFIG_REPEAT_RATE 2
+#define CONFIG_AUTO_BRIGHTNESS 4
+#define CONFIG_BRIGHTNESS 5
+#define CONFIG_LENGTH 6
+
+// Decodes the next byte of a frame from GUI.
+uint8_t receiveConfigByte(uint8_t byte);
+
+// Applies and stores the settings and macro data received from GUI.
+uint8_t applyConfig(uint16_t* initialRepeatDelay, uint16_t* repeatPressDelay);
\ No newline at end of file
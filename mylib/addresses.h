@@ -6,14 +6,24 @@
 
 #pragma once
 
-// EEPROM addresses for global configuration data.
+// EEPROM addresses of global configuration data before the settings journal,
+// only read until every setting has a record in the journal.
 #define BRIGHTNESS_ADDRESS 0
 #define AUTOBRIGHT_ADDRESS 1
 #define INIT_REPEAT_DELAY_ADDRESS 2
 #define REPEAT_RATE_ADDRESS 4
 
-// EEPROM addresses for macro data.
+// EEPROM addresses for macro data before the image banks, only read until
+// the first image is written over them.
 #define NAME_ADDRESS 10
 #define COLOUR_ADDRESS 330
 #define NUM_ACTIONS_ADDRESS 360
 #define ACTIONS_ADDRESS 370
+
+// EEPROM address and size of each of the two banks of the macro image.
+#define IMAGE_ADDRESS 0
+#define IMAGE_BANK_SIZE 432
+
+// EEPROM address and number of 5 byte records of the settings journal.
+#define SETTINGS_ADDRESS 864
+#define SETTINGS_RECORDS 32
\ No newline at end of file
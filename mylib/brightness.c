@@ -8,7 +8,7 @@
 #include "16bitcolours.h"
 #include "lcd.h"
 #include "rgbled.h"
-#include <avr/io.h>
+#include "hal.h"
 
 /* initAutoBrightness()
  * --------------------
@@ -0,0 +1,18 @@
+/*
+ * brightness.h
+ *
+ * TEAM 01 ENGG2800
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Initialises ADC to read ADC value from light sensor.
+void initAutoBrightness(void);
+
+// Returns a brightness level between 0 and 9 based on the light sensor.
+uint8_t getAutoBrightnessLevel(void);
+
+// Sets the brightness level for LCD and RGB LEDs.
+void setBrightness(uint8_t brightnessLevel);
\ No newline at end of file
@@ -13,7 +13,7 @@
  * @depend      
  * ---------------------------------------------------------------+
  */
-#include <avr/pgmspace.h>
+#include "hal.h"
 
 #ifndef __FONT_H__
 #define __FONT_H__
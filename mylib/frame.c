@@ -0,0 +1,184 @@
+/*
+ * frame.c
+ *
+ * Team 01 ENGG2800
+ */
+
+#include "frame.h"
+#include "timer.h"
+#include "hal.h"
+
+// States of the frame parser.
+#define STATE_IDLE 0
+#define STATE_LENGTH_HIGH 1
+#define STATE_LENGTH_LOW 2
+#define STATE_SEQUENCE 3
+#define STATE_PAYLOAD 4
+#define STATE_CRC_HIGH 5
+#define STATE_CRC_LOW 6
+#define STATE_DISCARD 7 // Drop bytes until the line is quiet.
+
+#define NO_SEQUENCE 0x100 // No frame applied since reset.
+
+// Frame being received.
+static volatile uint8_t state;
+static uint16_t length;
+static uint16_t received;
+static uint8_t sequence;
+static uint8_t repeat; // Frame is the last applied frame sent again.
+static uint16_t crc;
+static uint16_t frameCrc;
+static volatile uint32_t lastByteTime;
+
+// Outcome of a frame whose payload was decoded, kept until it is handled.
+static volatile uint8_t result;
+static uint16_t appliedSequence = NO_SEQUENCE;
+
+/* endFrame()
+ * ----------
+ * Ends the frame being received. Must be called with interrupts disabled.
+ *
+ * outcome: the value for frameResult() to return.
+ */
+static void endFrame(uint8_t outcome)
+{
+    result = repeat && outcome == FRAME_DONE ? FRAME_REPEAT : outcome;
+}
+
+/* frameReceive()
+ * --------------
+ * Adds a byte received through USART to the frame being received. Called
+ * from the USART receive interrupt so the frame is checked as it arrives and
+ * the payload is decoded by the caller without being stored. Frames that are
+ * too long or arrive before the last frame was handled are rejected, and a
+ * frame that fails the CRC or stops arriving is reported by frameResult().
+ * The payload of a repeated frame is checked but not passed on.
+ *
+ * byte: the byte received.
+ *
+ * Returns: FRAME_NONE if the byte is not part of a frame, FRAME_BUSY if it
+ *     was added to the frame, FRAME_BEGIN when the payload follows,
+ *     FRAME_DATA for a payload byte to decode, FRAME_END when the frame has
+ *     ended or FRAME_ERROR when a frame is rejected before its payload.
+ */
+uint8_t frameReceive(uint8_t byte)
+{
+    // Give up on a frame (or stop dropping bytes) after a gap in the data.
+    uint32_t now = getCurrentTime();
+    if (state != STATE_IDLE && now - lastByteTime > FRAME_TIMEOUT) {
+        if (state >= STATE_PAYLOAD && state <= STATE_CRC_LOW)
+            endFrame(FRAME_FAILED);
+        state = STATE_IDLE;
+    }
+    lastByteTime = now;
+
+    if (state != STATE_IDLE && state != STATE_DISCARD
+        && state != STATE_CRC_HIGH && state != STATE_CRC_LOW)
+        crc = _crc_xmodem_update(crc, byte);
+
+    switch (state) {
+    case STATE_IDLE:
+        if (byte != FRAME_START)
+            return FRAME_NONE;
+        crc = FRAME_CRC_INIT;
+        state = STATE_LENGTH_HIGH;
+        return FRAME_BUSY;
+
+    case STATE_LENGTH_HIGH:
+        length = byte << 8;
+        state = STATE_LENGTH_LOW;
+        return FRAME_BUSY;
+
+    case STATE_LENGTH_LOW:
+        length |= byte;
+        received = 0;
+        state = STATE_SEQUENCE;
+        return FRAME_BUSY;
+
+    case STATE_SEQUENCE:
+        if (length > FRAME_MAX_LENGTH || result) {
+            state = STATE_DISCARD;
+            return FRAME_ERROR;
+        }
+        sequence = byte;
+        repeat = sequence == appliedSequence;
+        state = length ? STATE_PAYLOAD : STATE_CRC_HIGH;
+        return repeat ? FRAME_BUSY : FRAME_BEGIN;
+
+    case STATE_PAYLOAD:
+        if (++received == length)
+            state = STATE_CRC_HIGH;
+        return repeat ? FRAME_BUSY : FRAME_DATA;
+
+    case STATE_CRC_HIGH:
+        frameCrc = byte << 8;
+        state = STATE_CRC_LOW;
+        return FRAME_BUSY;
+
+    case STATE_CRC_LOW:
+        frameCrc |= byte;
+        state = STATE_IDLE;
+        endFrame(frameCrc == crc ? FRAME_DONE : FRAME_FAILED);
+        return FRAME_END;
+
+    default:
+        return FRAME_BUSY;
+    }
+}
+
+/* frameAbort()
+ * ------------
+ * Rejects the frame being received when its payload cannot be decoded. The
+ * rest of the frame is dropped. Called from the USART receive interrupt.
+ */
+void frameAbort(void)
+{
+    endFrame(FRAME_FAILED);
+    state = STATE_DISCARD;
+}
+
+/* frameResult()
+ * -------------
+ * Gets the outcome of the last frame. A frame whose bytes stopped arriving
+ * part way through the payload is failed here, so a half received frame is
+ * undone even if nothing else is sent.
+ *
+ * Returns: FRAME_NONE while no frame has ended, otherwise FRAME_DONE,
+ *     FRAME_REPEAT or FRAME_FAILED.
+ */
+uint8_t frameResult(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (state >= STATE_PAYLOAD && state <= STATE_CRC_LOW
+        && getCurrentTime() - lastByteTime > FRAME_TIMEOUT) {
+        endFrame(FRAME_FAILED);
+        state = STATE_IDLE;
+    }
+    uint8_t outcome = result;
+    SREG = sreg;
+    return outcome;
+}
+
+/* frameSequence()
+ * ---------------
+ * Returns: the sequence number of the frame that has ended.
+ */
+uint8_t frameSequence(void)
+{
+    return sequence;
+}
+
+/* frameRelease()
+ * --------------
+ * Allows a new frame to be received once the last frame has been handled.
+ *
+ * applied: whether the frame was applied, so it is only acknowledged if it
+ *     is sent again.
+ */
+void frameRelease(uint8_t applied)
+{
+    if (applied)
+        appliedSequence = sequence;
+    result = FRAME_NONE;
+}
@@ -0,0 +1,48 @@
+/*
+ * frame.h
+ *
+ * Team 01 ENGG2800
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// A frame from the GUI is 'M', the payload length (2 bytes), a sequence
+// number (1 byte), the payload and a CRC-16 (2 bytes) of the length,
+// sequence number and payload. Multi-byte fields are sent high byte first.
+#define FRAME_START 'M' // First byte of a frame.
+#define FRAME_ACK 'K' // Reply, then sequence number and bytes written.
+#define FRAME_NAK 'N' // Reply when a frame is rejected.
+#define FRAME_FULL 'F' // Reply when a frame's macro data does not fit.
+#define FRAME_MAX_LENGTH 770 // Max number of payload bytes in a frame.
+#define FRAME_TIMEOUT 20 // Max ms between bytes of a frame.
+#define FRAME_CRC_INIT 0xFFFF // Initial CRC-16 (CCITT) value.
+
+// Values returned by frameReceive().
+#define FRAME_NONE 0 // Byte is not part of a frame.
+#define FRAME_BUSY 1 // Byte was added to the frame being received.
+#define FRAME_BEGIN 2 // Payload of a new frame follows.
+#define FRAME_DATA 3 // Byte is part of the payload and must be decoded.
+#define FRAME_END 4 // Frame has ended, frameResult() gives the outcome.
+#define FRAME_ERROR 5 // Frame is rejected before any payload was decoded.
+
+// Values returned by frameResult().
+#define FRAME_DONE 1 // Frame was received and its CRC is correct.
+#define FRAME_REPEAT 2 // Frame is the last applied frame sent again.
+#define FRAME_FAILED 3 // Frame was rejected after its payload was decoded.
+
+// Adds a byte received through USART to the frame being received.
+uint8_t frameReceive(uint8_t byte);
+
+// Rejects the frame being received when its payload cannot be decoded.
+void frameAbort(void);
+
+// Returns the outcome of the last frame once it has ended.
+uint8_t frameResult(void);
+
+// Returns the sequence number of the frame that has ended.
+uint8_t frameSequence(void);
+
+// Allows a new frame to be received once the last one has been handled.
+void frameRelease(uint8_t applied);
@@ -0,0 +1,244 @@
+/*
+ * hal.h
+ *
+ * Team 01 ENGG2800
+ *
+ * Register level hardware abstraction. On the ATmega328P this simply pulls in
+ * the avr-libc headers. Everywhere else (HAL_HOST) the same register names are
+ * backed by a simulator in hal_host.c so the firmware builds and runs as a
+ * normal Linux program.
+ */
+
+#pragma once
+
+#ifndef F_CPU
+#define F_CPU 11059200L
+#endif
+
+#include <stdint.h>
+
+#if defined(__AVR__)
+
+#include <avr/common.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/crc16.h>
+#include <util/delay.h>
+
+#else
+
+#define HAL_HOST 1
+
+// Plain registers which have no side effects when accessed.
+extern volatile uint8_t halHostDDRB, halHostPORTB, halHostPINB;
+extern volatile uint8_t halHostDDRC, halHostPORTC, halHostPINC;
+extern volatile uint8_t halHostDDRD, halHostPORTD;
+extern volatile uint8_t halHostSPCR, halHostUCSR0B, halHostUCSR0C;
+extern volatile uint16_t halHostUBRR0;
+extern volatile uint8_t halHostTCCR0A, halHostTCCR0B, halHostTCNT0;
+extern volatile uint8_t halHostOCR0A, halHostTIMSK0, halHostTIFR0;
+extern volatile uint8_t halHostTCCR1A, halHostTCCR1B;
+extern volatile uint8_t halHostTCCR2A, halHostTCCR2B, halHostTCNT2;
+extern volatile uint8_t halHostOCR2A, halHostTIMSK2, halHostTIFR2;
+extern volatile uint16_t halHostOCR1A;
+extern volatile uint8_t halHostADMUX;
+extern volatile uint16_t halHostADC;
+extern volatile uint16_t halHostEEAR;
+extern volatile uint8_t halHostPCICR, halHostPCMSK2, halHostPCIFR;
+
+// Registers whose access advances the simulation (polled flags, data
+// registers and SREG).
+volatile uint8_t* halHostPinD(void);
+volatile uint8_t* halHostSpsr(void);
+volatile uint16_t* halHostSpdr(void);
+volatile uint8_t* halHostUcsr0a(void);
+volatile uint16_t* halHostUdr0(void);
+volatile uint8_t* halHostAdcsra(void);
+volatile uint8_t* halHostEecr(void);
+volatile uint16_t* halHostEedr(void);
+volatile uint8_t* halHostSreg(void);
+
+#define DDRB halHostDDRB
+#define PORTB halHostPORTB
+#define PINB halHostPINB
+#define DDRC halHostDDRC
+#define PORTC halHostPORTC
+#define PINC halHostPINC
+#define DDRD halHostDDRD
+#define PORTD halHostPORTD
+#define PIND (*halHostPinD())
+
+#define SPCR halHostSPCR
+#define SPSR (*halHostSpsr())
+#define SPDR (*halHostSpdr())
+
+#define UBRR0 halHostUBRR0
+#define UCSR0A (*halHostUcsr0a())
+#define UCSR0B halHostUCSR0B
+#define UCSR0C halHostUCSR0C
+#define UDR0 (*halHostUdr0())
+
+#define TCCR0A halHostTCCR0A
+#define TCCR0B halHostTCCR0B
+#define TCNT0 halHostTCNT0
+#define OCR0A halHostOCR0A
+#define TIMSK0 halHostTIMSK0
+#define TIFR0 halHostTIFR0
+#define TCCR1A halHostTCCR1A
+#define TCCR1B halHostTCCR1B
+#define OCR1A halHostOCR1A
+#define TCCR2A halHostTCCR2A
+#define TCCR2B halHostTCCR2B
+#define TCNT2 halHostTCNT2
+#define OCR2A halHostOCR2A
+#define TIMSK2 halHostTIMSK2
+#define TIFR2 halHostTIFR2
+
+#define ADMUX halHostADMUX
+#define ADCSRA (*halHostAdcsra())
+#define ADC halHostADC
+
+#define EEAR halHostEEAR
+#define EECR (*halHostEecr())
+#define EEDR (*halHostEedr())
+
+#define PCICR halHostPCICR
+#define PCMSK2 halHostPCMSK2
+#define PCIFR halHostPCIFR
+
+#define SREG (*halHostSreg())
+
+// Register bits (ATmega328P datasheet).
+#define SREG_I 7
+
+#define SPIE 7
+#define SPE 6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+#define SPIF 7
+#define WCOL 6
+#define SPI2X 0
+
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ01 2
+#define UCSZ00 1
+
+#define WGM01 1
+#define WGM00 0
+#define CS02 2
+#define CS01 1
+#define CS00 0
+#define OCIE0A 1
+#define OCF0A 1
+#define COM1A1 7
+#define COM1A0 6
+#define WGM10 0
+#define WGM12 3
+#define CS10 0
+#define WGM21 1
+#define CS21 1
+#define OCIE2A 1
+#define OCF2A 1
+
+#define REFS0 6
+#define ADEN 7
+#define ADSC 6
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+#define EEPM1 5
+#define EEPM0 4
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
+
+#define PCIE2 2
+#define PCIF2 2
+#define PCINT21 5
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+// Interrupts. Each vector is an ordinary function called by the simulator.
+#define ISR(vector) void vector(void)
+#define PCINT2_vect halHostVectPcint2
+#define TIMER2_COMPA_vect halHostVectTimer2CompA
+#define TIMER0_COMPA_vect halHostVectTimer0CompA
+#define SPI_STC_vect halHostVectSpiStc
+#define USART_RX_vect halHostVectUsartRx
+#define USART_UDRE_vect halHostVectUsartUdre
+#define ADC_vect halHostVectAdc
+#define EE_READY_vect halHostVectEeReady
+
+void PCINT2_vect(void);
+void TIMER2_COMPA_vect(void);
+void TIMER0_COMPA_vect(void);
+void SPI_STC_vect(void);
+void USART_RX_vect(void);
+void USART_UDRE_vect(void);
+void ADC_vect(void);
+void EE_READY_vect(void);
+
+void sei(void);
+void cli(void);
+
+// Sleep modes. Only idle mode is simulated, which wakes on any interrupt.
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(mode) ((void)(mode))
+void sleep_mode(void);
+
+// Program memory lives in ordinary memory on the host.
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+
+// CRC-16 (polynomial 0x1021) update, as in avr-libc util/crc16.h.
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+    crc ^= (uint16_t)data << 8;
+    for (uint8_t i = 0; i < 8; i++)
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    return crc;
+}
+
+// CRC-8 (polynomial 0x07) update, as in avr-libc util/crc16.h.
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++)
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    return crc;
+}
+
+// Busy-wait delays advance simulated time instead of sleeping.
+void halHostDelayCycles(uint32_t cycles);
+#define _delay_us(us) halHostDelayCycles((uint32_t)((us) * (F_CPU / 1000000.0)))
+#define _delay_ms(ms) halHostDelayCycles((uint32_t)((ms) * (F_CPU / 1000.0)))
+
+// Simulator controls, used by the board model and by host scenarios.
+uint64_t halHostCycles(void);
+uint32_t halHostMillis(void);
+void halHostSetKey(uint8_t col, uint8_t row, uint8_t pressed);
+void halHostUartInject(const uint8_t* bytes, uint16_t length);
+void halHostSetLight(uint16_t adcValue);
+void halHostLedWrite(const uint8_t* data, uint16_t length);
+
+#endif
@@ -0,0 +1,1047 @@
+/*
+ * hal_host.c
+ *
+ * Team 01 ENGG2800
+ *
+ * Host backend for hal.h. Simulates the parts of the ATmega328P and the board
+ * that the firmware uses: GPIO with the key matrix and the seeeduino IDLE
+ * pin, SPI (LCD and HID co-processor), USART, ADC light sensor, EEPROM and
+ * the Timer 0 tick. Time only advances when the firmware touches a simulated
+ * register or delays, so busy-waits cost simulated time just like on the MCU.
+ * A loop that only polls RAM (e.g. a flag set by an interrupt) must also read
+ * the time or a register, otherwise simulated time never advances.
+ *
+ * The simulation is driven by environment variables:
+ *     MACROLYZE_SCRIPT   events as "<ms> <command> [args]; ..." where command
+ *                        is press/release <col> <row>, rx <hex bytes>,
+ *                        light <adc value>, mark (print CPU and SPI usage
+ *                        since the previous mark) or quit.
+ *     MACROLYZE_EEPROM   file to load EEPROM from and save it back to.
+ *     MACROLYZE_TX_LOG   file that receives every byte sent through USART.
+ *     MACROLYZE_LCD_DUMP PPM file written with the LCD contents on exit.
+ *     MACROLYZE_TRACE    print every HID report sent to the co-processor.
+ * Statistics are printed to stderr when the program exits. Busy-waits are
+ * reported as time the main program (not interrupts) spent repeatedly
+ * polling the same flag register.
+ */
+
+#include "hal.h"
+
+#ifdef HAL_HOST
+
+#include "keypad.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ACCESS_CYCLES 4 // Cost of one polled register access.
+#define ISR_CYCLES 10 // Cost of entering and leaving an interrupt.
+#define EEPROM_SIZE 1024
+#define EEPROM_WRITE_CYCLES (F_CPU / 1000000 * 3400) // Erase and write.
+#define EEPROM_HALF_CYCLES (F_CPU / 1000000 * 1800) // Erase or write only.
+#define HID_BUSY_CYCLES (F_CPU / 1000) // Co-processor busy per report.
+#define HID_SS (1 << 1) // PORTC pin for seeeduino SS.
+#define HID_IDLE (1 << 5) // PIND pin for seeeduino IDLE.
+#define LCD_CS (1 << 2) // PORTB pin for LCD chip select.
+#define LCD_DC (1 << 0) // PORTB pin for LCD data/command.
+#define REPORT_BYTES 8 // Bytes in a HID report.
+#define LCD_WIDTH 160
+#define LCD_HEIGHT 104
+#define SLOT_EMPTY 0x100 // Data register slot not written since last access.
+#define MAX_EVENTS 256
+#define RX_QUEUE 4096
+#define SPIN_GAP 32 // Max cycles between polls counted as one busy-wait.
+
+volatile uint8_t halHostDDRB, halHostPORTB, halHostPINB;
+volatile uint8_t halHostDDRC, halHostPORTC, halHostPINC;
+volatile uint8_t halHostDDRD, halHostPORTD;
+volatile uint8_t halHostSPCR, halHostUCSR0B, halHostUCSR0C;
+volatile uint16_t halHostUBRR0;
+volatile uint8_t halHostTCCR0A, halHostTCCR0B, halHostTCNT0;
+volatile uint8_t halHostOCR0A, halHostTIMSK0, halHostTIFR0;
+volatile uint8_t halHostTCCR1A, halHostTCCR1B;
+volatile uint8_t halHostTCCR2A, halHostTCCR2B, halHostTCNT2;
+volatile uint8_t halHostOCR2A, halHostTIMSK2, halHostTIFR2;
+volatile uint16_t halHostOCR1A;
+volatile uint8_t halHostADMUX;
+volatile uint16_t halHostADC;
+volatile uint16_t halHostEEAR;
+volatile uint8_t halHostPCICR, halHostPCMSK2, halHostPCIFR;
+
+static volatile uint8_t pind, spsr, ucsr0a, adcsra, eecr, sreg;
+static volatile uint16_t spdrSlot, udr0Slot, eedrSlot;
+
+// A scheduled scenario event.
+struct event {
+    uint32_t time;
+    char command[8];
+    uint16_t args[64];
+    uint8_t numArgs;
+};
+
+// Whole simulator state.
+static struct {
+    uint8_t initialised;
+    uint8_t inService;
+    uint8_t inVector;
+    uint32_t vectorCalls; // Interrupts dispatched, used to wake from sleep.
+    uint64_t cycles;
+
+    // Busy-waits of the main program, timed in cycles outside interrupts.
+    uint64_t vectorCycles; // Cycles spent in interrupt handlers.
+    volatile uint8_t* spinRegister;
+    uint64_t spinStart;
+    uint64_t spinLast;
+    uint64_t spinTotal;
+    uint64_t spinMax;
+
+    // Statistics at the previous mark.
+    uint64_t markCycles;
+    uint64_t markSpinTotal;
+    uint64_t markSpinMax; // Longest busy-wait since the previous mark.
+    uint64_t markVectorCycles;
+    uint32_t markLcdBytes;
+    uint32_t markHidBytes;
+    uint32_t markTimerTicks;
+    uint32_t markTimerLost;
+
+    // Scenario.
+    struct event events[MAX_EVENTS];
+    uint16_t numEvents;
+    uint16_t nextEvent;
+    uint8_t trace;
+    FILE* txLog;
+
+    // Key matrix and scan timing.
+    uint8_t keys[COLS][ROWS];
+    uint64_t lastScan;
+    uint64_t maxScanGap;
+    uint64_t pressCycle;
+    uint8_t pressPending;
+    uint32_t pressCount;
+    uint64_t pressLatencySum;
+    uint64_t pressLatencyMax;
+
+    // SPI.
+    uint8_t spiBusy;
+    uint8_t spiByte;
+    uint64_t spiDoneAt;
+    uint32_t spiLcdBytes;
+    uint32_t spiHidBytes;
+    uint64_t spiBusyCycles;
+
+    // HID co-processor.
+    uint8_t report[REPORT_BYTES];
+    uint8_t reportLength;
+    uint64_t hidBusyUntil;
+    uint32_t hidReports;
+    uint64_t firstHid; // Time of the first report, to time start up.
+    uint8_t hidIdle;
+    uint8_t pinChangePending;
+
+    // LCD.
+    uint8_t lcdCommand;
+    uint8_t lcdParam;
+    uint8_t lcdParams[4];
+    uint8_t x0, x1, y0, y1, x, y;
+    uint8_t pixelHigh;
+    uint8_t pixelHalf;
+    uint32_t lcdCommands;
+    uint32_t lcdPixels;
+    uint16_t frame[LCD_HEIGHT][LCD_WIDTH];
+
+    // USART.
+    uint8_t txBuffered;
+    uint8_t txBufferByte;
+    uint64_t txShiftDoneAt;
+    uint8_t txShifting;
+    uint32_t txBytes;
+    uint8_t rxQueue[RX_QUEUE];
+    uint16_t rxHead;
+    uint16_t rxTail;
+    uint64_t rxNextAt;
+    uint8_t rxData;
+    uint32_t rxBytes;
+    uint32_t rxOverruns;
+
+    // ADC.
+    uint16_t light;
+    uint8_t adcBusy;
+    uint64_t adcDoneAt;
+
+    // EEPROM.
+    uint8_t eeprom[EEPROM_SIZE];
+    uint8_t eepromBusy;
+    uint64_t eepromDoneAt;
+    uint16_t eepromAddress;
+    uint8_t eepromData;
+    uint8_t eepromMode;
+    uint32_t eepromWrites;
+    uint32_t eepromReads;
+    uint64_t eepromBusyCycles;
+    uint8_t eedr;
+
+    // Timer 0.
+    uint8_t timerRunning;
+    uint64_t timerNext;
+    uint8_t timerPending;
+    uint32_t timerTicks;
+    uint32_t timerLost;
+
+    // Timer 2.
+    uint8_t timer2Running;
+    uint64_t timer2Next;
+    uint8_t timer2Pending;
+
+    // LEDs.
+    uint32_t ledBytes;
+} sim;
+
+// Default (empty) vectors for interrupts the firmware does not use.
+__attribute__((weak)) void halHostVectPcint2(void) { }
+__attribute__((weak)) void halHostVectTimer2CompA(void) { }
+__attribute__((weak)) void halHostVectTimer0CompA(void) { }
+__attribute__((weak)) void halHostVectSpiStc(void) { }
+__attribute__((weak)) void halHostVectUsartRx(void) { (void)UDR0; }
+__attribute__((weak)) void halHostVectUsartUdre(void) { UCSR0B &= ~(1 << UDRIE0); }
+__attribute__((weak)) void halHostVectAdc(void) { }
+__attribute__((weak)) void halHostVectEeReady(void) { EECR &= ~(1 << EERIE); }
+
+static void service(void);
+
+/* cyclesToMs()
+ * ------------
+ * Converts simulated CPU cycles to milliseconds.
+ */
+static double cyclesToMs(uint64_t cycles)
+{
+    return (double)cycles * 1000.0 / (double)F_CPU;
+}
+
+/* report()
+ * --------
+ * Prints the simulation statistics and saves EEPROM and LCD contents.
+ */
+static void report(void)
+{
+    fprintf(stderr, "sim: time %.1f ms (%llu cycles)\n",
+        cyclesToMs(sim.cycles), (unsigned long long)sim.cycles);
+    fprintf(stderr, "sim: timer0 ticks %lu, lost %lu\n",
+        (unsigned long)sim.timerTicks, (unsigned long)sim.timerLost);
+    fprintf(stderr, "sim: spi lcd bytes %lu, hid bytes %lu, busy %.1f ms\n",
+        (unsigned long)sim.spiLcdBytes, (unsigned long)sim.spiHidBytes,
+        cyclesToMs(sim.spiBusyCycles));
+    fprintf(stderr, "sim: lcd commands %lu, pixels %lu\n",
+        (unsigned long)sim.lcdCommands, (unsigned long)sim.lcdPixels);
+    fprintf(stderr, "sim: hid reports %lu, first at %.1f ms\n",
+        (unsigned long)sim.hidReports, cyclesToMs(sim.firstHid));
+    fprintf(stderr, "sim: usart tx %lu, rx %lu, rx overruns %lu\n",
+        (unsigned long)sim.txBytes, (unsigned long)sim.rxBytes,
+        (unsigned long)sim.rxOverruns);
+    fprintf(stderr, "sim: eeprom reads %lu, writes %lu, busy %.1f ms\n",
+        (unsigned long)sim.eepromReads, (unsigned long)sim.eepromWrites,
+        cyclesToMs(sim.eepromBusyCycles));
+    fprintf(stderr, "sim: led bytes %lu\n", (unsigned long)sim.ledBytes);
+    fprintf(stderr, "sim: longest key scan gap %.2f ms\n",
+        cyclesToMs(sim.maxScanGap));
+    fprintf(stderr, "sim: main busy-wait total %.1f ms, longest %.2f ms\n",
+        cyclesToMs(sim.spinTotal), cyclesToMs(sim.spinMax));
+    if (sim.pressCount) {
+        fprintf(stderr, "sim: key to hid latency avg %.2f ms, max %.2f ms"
+                        " (%lu presses)\n",
+            cyclesToMs(sim.pressLatencySum / sim.pressCount),
+            cyclesToMs(sim.pressLatencyMax), (unsigned long)sim.pressCount);
+    }
+
+    char* path = getenv("MACROLYZE_EEPROM");
+    if (path) {
+        FILE* file = fopen(path, "wb");
+        if (file) {
+            fwrite(sim.eeprom, 1, EEPROM_SIZE, file);
+            fclose(file);
+        }
+    }
+
+    path = getenv("MACROLYZE_LCD_DUMP");
+    if (path) {
+        FILE* file = fopen(path, "wb");
+        if (file) {
+            fprintf(file, "P6\n%d %d\n255\n", LCD_WIDTH, LCD_HEIGHT);
+            for (uint8_t y = 0; y < LCD_HEIGHT; y++) {
+                for (uint8_t x = 0; x < LCD_WIDTH; x++) {
+                    uint16_t pixel = sim.frame[y][x];
+                    fputc((pixel >> 11) << 3, file);
+                    fputc(((pixel >> 5) & 0x3F) << 2, file);
+                    fputc((pixel & 0x1F) << 3, file);
+                }
+            }
+            fclose(file);
+        }
+    }
+
+    if (sim.txLog)
+        fclose(sim.txLog);
+}
+
+/* parseScript()
+ * -------------
+ * Parses the scenario in MACROLYZE_SCRIPT into the event list.
+ */
+static void parseScript(const char* script)
+{
+    char* copy = strdup(script);
+    char* save = NULL;
+    for (char* item = strtok_r(copy, ";", &save);
+         item && sim.numEvents < MAX_EVENTS;
+         item = strtok_r(NULL, ";", &save)) {
+        struct event* event = &sim.events[sim.numEvents];
+        char* end;
+        event->time = strtoul(item, &end, 10);
+        if (end == item || sscanf(end, " %7s", event->command) != 1)
+            continue;
+
+        // Arguments are decimal except for rx, which takes hex bytes.
+        char* args = strstr(end, event->command) + strlen(event->command);
+        int base = strcmp(event->command, "rx") ? 10 : 16;
+        event->numArgs = 0;
+        while (event->numArgs < 64) {
+            unsigned long value = strtoul(args, &end, base);
+            if (end == args)
+                break;
+            event->args[event->numArgs++] = (uint16_t)value;
+            args = end;
+        }
+        sim.numEvents++;
+    }
+    free(copy);
+}
+
+/* initialise()
+ * ------------
+ * Sets up the simulated power-on state and reads the scenario.
+ */
+static void initialise(void)
+{
+    sim.initialised = 1;
+    memset(sim.eeprom, 0xFF, EEPROM_SIZE);
+    sim.light = 500;
+    spdrSlot = SLOT_EMPTY;
+    udr0Slot = SLOT_EMPTY;
+    eedrSlot = SLOT_EMPTY;
+    ucsr0a = (1 << UDRE0);
+    sim.hidIdle = 1;
+
+    char* path = getenv("MACROLYZE_EEPROM");
+    if (path) {
+        FILE* file = fopen(path, "rb");
+        if (file) {
+            if (fread(sim.eeprom, 1, EEPROM_SIZE, file) != EEPROM_SIZE)
+                fprintf(stderr, "sim: short eeprom image %s\n", path);
+            fclose(file);
+        }
+    }
+
+    path = getenv("MACROLYZE_TX_LOG");
+    if (path)
+        sim.txLog = fopen(path, "wb");
+
+    sim.trace = getenv("MACROLYZE_TRACE") != NULL;
+
+    char* script = getenv("MACROLYZE_SCRIPT");
+    if (script)
+        parseScript(script);
+
+    atexit(report);
+}
+
+/* mark()
+ * ------
+ * Prints how the CPU and SPI bus were used since the previous mark: main
+ * program busy-waits, time in interrupts, the remaining idle share of the CPU
+ * and the SPI throughput of each device.
+ */
+static void mark(void)
+{
+    uint64_t window = sim.cycles - sim.markCycles;
+    uint64_t busy = sim.spinTotal - sim.markSpinTotal;
+    uint64_t vectors = sim.vectorCycles - sim.markVectorCycles;
+    uint32_t lcdBytes = sim.spiLcdBytes - sim.markLcdBytes;
+    uint32_t hidBytes = sim.spiHidBytes - sim.markHidBytes;
+    double seconds = cyclesToMs(window) / 1000;
+
+    fprintf(stderr, "sim: mark %.1f ms, window %.1f ms\n",
+        cyclesToMs(sim.cycles), cyclesToMs(window));
+    fprintf(stderr, "sim:   busy-wait %.1f ms (longest %.2f ms),"
+                    " interrupts %.1f ms, cpu idle %.1f%%\n",
+        cyclesToMs(busy), cyclesToMs(sim.markSpinMax), cyclesToMs(vectors),
+        window ? 100.0 * (window - busy - vectors) / window : 100.0);
+    fprintf(stderr, "sim:   timer0 ticks %lu, lost %lu\n",
+        (unsigned long)(sim.timerTicks - sim.markTimerTicks),
+        (unsigned long)(sim.timerLost - sim.markTimerLost));
+    fprintf(stderr, "sim:   spi lcd %lu bytes (%.0f bytes/s),"
+                    " hid %lu bytes (%.0f bytes/s)\n",
+        (unsigned long)lcdBytes, seconds ? lcdBytes / seconds : 0,
+        (unsigned long)hidBytes, seconds ? hidBytes / seconds : 0);
+
+    sim.markCycles = sim.cycles;
+    sim.markSpinTotal = sim.spinTotal;
+    sim.markSpinMax = 0;
+    sim.markVectorCycles = sim.vectorCycles;
+    sim.markLcdBytes = sim.spiLcdBytes;
+    sim.markHidBytes = sim.spiHidBytes;
+    sim.markTimerTicks = sim.timerTicks;
+    sim.markTimerLost = sim.timerLost;
+}
+
+/* runEvents()
+ * -----------
+ * Executes the scenario events that are due.
+ */
+static void runEvents(void)
+{
+    while (sim.nextEvent < sim.numEvents
+        && sim.events[sim.nextEvent].time <= halHostMillis()) {
+        struct event* event = &sim.events[sim.nextEvent++];
+        if (!strcmp(event->command, "press") && event->numArgs == 2) {
+            halHostSetKey(event->args[0], event->args[1], 1);
+        } else if (!strcmp(event->command, "release") && event->numArgs == 2) {
+            halHostSetKey(event->args[0], event->args[1], 0);
+        } else if (!strcmp(event->command, "rx")) {
+            uint8_t bytes[64];
+            for (uint8_t i = 0; i < event->numArgs; i++)
+                bytes[i] = event->args[i];
+            halHostUartInject(bytes, event->numArgs);
+        } else if (!strcmp(event->command, "light") && event->numArgs == 1) {
+            halHostSetLight(event->args[0]);
+        } else if (!strcmp(event->command, "mark")) {
+            mark();
+        } else if (!strcmp(event->command, "quit")) {
+            exit(0);
+        }
+    }
+}
+
+/* spiDivider()
+ * ------------
+ * Gets the SPI clock divider from SPCR and SPSR.
+ */
+static uint8_t spiDivider(void)
+{
+    static const uint8_t dividers[4] = { 4, 16, 64, 128 };
+    uint8_t divider = dividers[halHostSPCR & 0x03];
+    if (spsr & (1 << SPI2X))
+        divider /= 2;
+    return divider;
+}
+
+/* lcdByte()
+ * ---------
+ * Feeds a byte received by the LCD into the ST7735 model.
+ */
+static void lcdByte(uint8_t byte, uint8_t data)
+{
+    sim.spiLcdBytes++;
+    if (!data) {
+        sim.lcdCommand = byte;
+        sim.lcdParam = 0;
+        sim.pixelHalf = 0;
+        sim.lcdCommands++;
+        if (byte == 0x2C) { // RAMWR
+            sim.x = sim.x0;
+            sim.y = sim.y0;
+        }
+        return;
+    }
+
+    if (sim.lcdCommand == 0x2A || sim.lcdCommand == 0x2B) { // CASET, RASET
+        if (sim.lcdParam < 4)
+            sim.lcdParams[sim.lcdParam++] = byte;
+        if (sim.lcdParam == 4 && sim.lcdCommand == 0x2A) {
+            sim.x0 = sim.lcdParams[1];
+            sim.x1 = sim.lcdParams[3];
+        } else if (sim.lcdParam == 4) {
+            sim.y0 = sim.lcdParams[1];
+            sim.y1 = sim.lcdParams[3];
+        }
+    } else if (sim.lcdCommand == 0x2C) {
+        if (!sim.pixelHalf) {
+            sim.pixelHigh = byte;
+            sim.pixelHalf = 1;
+            return;
+        }
+        sim.pixelHalf = 0;
+        sim.lcdPixels++;
+        if (sim.x < LCD_WIDTH && sim.y < LCD_HEIGHT)
+            sim.frame[sim.y][sim.x] = (sim.pixelHigh << 8) | byte;
+        if (sim.x++ >= sim.x1) {
+            sim.x = sim.x0;
+            if (sim.y++ >= sim.y1)
+                sim.y = sim.y0;
+        }
+    }
+}
+
+/* hidReport()
+ * -----------
+ * Called when the seeeduino SS is released after a report was clocked in.
+ */
+static void hidReport(void)
+{
+    if (!sim.hidReports)
+        sim.firstHid = sim.cycles;
+    sim.hidReports++;
+    sim.hidBusyUntil = sim.cycles + HID_BUSY_CYCLES;
+
+    if (sim.pressPending) {
+        uint64_t latency = sim.cycles - sim.pressCycle;
+        sim.pressLatencySum += latency;
+        if (latency > sim.pressLatencyMax)
+            sim.pressLatencyMax = latency;
+        sim.pressCount++;
+        sim.pressPending = 0;
+    }
+
+    if (sim.trace) {
+        printf("hid %.3f", cyclesToMs(sim.cycles));
+        for (uint8_t i = 0; i < sim.reportLength; i++)
+            printf(" %02x", sim.report[i]);
+        printf("\n");
+    }
+    sim.reportLength = 0;
+}
+
+/* peripherals()
+ * -------------
+ * Commits register writes and advances every peripheral to the current time.
+ */
+static void peripherals(void)
+{
+    uint8_t value;
+
+    // SPI: a write to SPDR starts a transfer.
+    if (spdrSlot < SLOT_EMPTY) {
+        value = spdrSlot;
+        spdrSlot = SLOT_EMPTY | 0xFF;
+        if (!sim.spiBusy && (halHostSPCR & (1 << SPE))) {
+            sim.spiBusy = 1;
+            sim.spiByte = value;
+            sim.spiDoneAt = sim.cycles + 8 * spiDivider();
+        } else if (sim.spiBusy) {
+            spsr |= (1 << WCOL);
+        }
+    }
+    if (sim.spiBusy && sim.cycles >= sim.spiDoneAt) {
+        sim.spiBusy = 0;
+        sim.spiBusyCycles += 8 * spiDivider();
+        spsr |= (1 << SPIF);
+        if (!(halHostPORTB & LCD_CS)) {
+            lcdByte(sim.spiByte, halHostPORTB & LCD_DC);
+        } else if (!(halHostPORTC & HID_SS)) {
+            sim.spiHidBytes++;
+            if (sim.reportLength < sizeof(sim.report))
+                sim.report[sim.reportLength++] = sim.spiByte;
+        }
+    }
+
+    // HID co-processor accepts the report when SS returns high.
+    if (sim.reportLength && (halHostPORTC & HID_SS) && !sim.spiBusy)
+        hidReport();
+
+    // USART transmitter: data register plus shift register.
+    uint64_t frame = 10ULL * 16 * (halHostUBRR0 + 1);
+    if (udr0Slot < SLOT_EMPTY) {
+        value = udr0Slot;
+        udr0Slot = SLOT_EMPTY | sim.rxData;
+        if (halHostUCSR0B & (1 << TXEN0)) {
+            sim.txBuffered = 1;
+            sim.txBufferByte = value;
+        }
+    }
+    if (sim.txShifting && sim.cycles >= sim.txShiftDoneAt) {
+        sim.txShifting = 0;
+        if (!sim.txBuffered)
+            ucsr0a |= (1 << TXC0);
+    }
+    if (sim.txBuffered && !sim.txShifting) {
+        sim.txBuffered = 0;
+        sim.txShifting = 1;
+        sim.txShiftDoneAt = sim.cycles + frame;
+        sim.txBytes++;
+        if (sim.txLog)
+            fputc(sim.txBufferByte, sim.txLog);
+    }
+    if (sim.txBuffered)
+        ucsr0a &= ~(1 << UDRE0);
+    else
+        ucsr0a |= (1 << UDRE0);
+
+    // USART receiver: one byte per frame from the injected queue.
+    if (sim.rxHead != sim.rxTail && sim.cycles >= sim.rxNextAt
+        && (halHostUCSR0B & (1 << RXEN0))) {
+        if (ucsr0a & (1 << RXC0))
+            sim.rxOverruns++;
+        sim.rxData = sim.rxQueue[sim.rxTail];
+        sim.rxTail = (sim.rxTail + 1) % RX_QUEUE;
+        sim.rxBytes++;
+        sim.rxNextAt = sim.cycles + frame;
+        ucsr0a |= (1 << RXC0);
+    }
+
+    // ADC conversion takes 13 ADC clocks.
+    if ((adcsra & (1 << ADSC)) && !sim.adcBusy) {
+        uint8_t prescaler = 1 << (adcsra & 0x07);
+        sim.adcBusy = 1;
+        sim.adcDoneAt = sim.cycles + 13 * (prescaler < 2 ? 2 : prescaler);
+    }
+    if (sim.adcBusy && sim.cycles >= sim.adcDoneAt) {
+        sim.adcBusy = 0;
+        halHostADC = sim.light;
+        adcsra = (adcsra & ~(1 << ADSC)) | (1 << ADIF);
+    }
+
+    // EEPROM: a write to EEDR latches the data byte.
+    if (eedrSlot < SLOT_EMPTY) {
+        sim.eedr = eedrSlot;
+        eedrSlot = SLOT_EMPTY | sim.eedr;
+    }
+    if (eecr & (1 << EERE)) {
+        eecr &= ~(1 << EERE);
+        if (!sim.eepromBusy) {
+            sim.eedr = sim.eeprom[halHostEEAR % EEPROM_SIZE];
+            sim.eepromReads++;
+            sim.cycles += 4; // CPU halted during read.
+        }
+    }
+    if ((eecr & (1 << EEPE)) && !sim.eepromBusy) {
+        sim.eepromBusy = 1;
+        sim.eepromAddress = halHostEEAR % EEPROM_SIZE;
+        sim.eepromData = sim.eedr;
+        sim.eepromMode = (eecr >> EEPM0) & 0x03;
+        uint32_t duration = sim.eepromMode ? EEPROM_HALF_CYCLES
+                                           : EEPROM_WRITE_CYCLES;
+        sim.eepromDoneAt = sim.cycles + duration;
+        sim.eepromBusyCycles += duration;
+        eecr &= ~(1 << EEMPE);
+    }
+    if (sim.eepromBusy && sim.cycles >= sim.eepromDoneAt) {
+        uint8_t* cell = &sim.eeprom[sim.eepromAddress];
+        if (sim.eepromMode == 0)
+            *cell = sim.eepromData;
+        else if (sim.eepromMode == 1)
+            *cell = 0xFF;
+        else
+            *cell &= sim.eepromData;
+        sim.eepromBusy = 0;
+        sim.eepromWrites++;
+        eecr &= ~(1 << EEPE);
+    }
+
+    // Pin change interrupt on the seeeduino IDLE pin.
+    uint8_t idle = sim.cycles >= sim.hidBusyUntil;
+    if (idle != sim.hidIdle) {
+        sim.hidIdle = idle;
+        if (halHostPCMSK2 & HID_IDLE)
+            sim.pinChangePending = 1;
+    }
+    if (halHostPCIFR & (1 << PCIF2)) {
+        sim.pinChangePending = 0;
+        halHostPCIFR = 0;
+    }
+
+    // Timer 0 in CTC mode.
+    static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    uint16_t prescaler = prescalers[halHostTCCR0B & 0x07];
+    if (halHostTIFR0 & (1 << OCF0A)) {
+        sim.timerPending = 0;
+        halHostTIFR0 = 0;
+    }
+    if (!prescaler) {
+        sim.timerRunning = 0;
+    } else {
+        uint32_t period = (uint32_t)prescaler
+            * ((halHostTCCR0A & (1 << WGM01)) ? halHostOCR0A + 1 : 256);
+        if (!sim.timerRunning) {
+            sim.timerRunning = 1;
+            sim.timerNext = sim.cycles + period;
+        }
+        while (sim.cycles >= sim.timerNext) {
+            if (sim.timerPending)
+                sim.timerLost++;
+            sim.timerPending = 1;
+            sim.timerNext += period;
+        }
+    }
+
+    // Timer 2 in CTC mode, counting from when it is started.
+    prescaler = prescalers[halHostTCCR2B & 0x07];
+    if (halHostTIFR2 & (1 << OCF2A)) {
+        sim.timer2Pending = 0;
+        halHostTIFR2 = 0;
+    }
+    if (!prescaler) {
+        sim.timer2Running = 0;
+    } else {
+        uint32_t period = (uint32_t)prescaler
+            * ((halHostTCCR2A & (1 << WGM21)) ? halHostOCR2A + 1 : 256);
+        if (!sim.timer2Running) {
+            sim.timer2Running = 1;
+            sim.timer2Next = sim.cycles + period;
+        }
+        while (sim.cycles >= sim.timer2Next) {
+            sim.timer2Pending = 1;
+            sim.timer2Next += period;
+        }
+    }
+}
+
+/* callVector()
+ * ------------
+ * Runs an interrupt handler with global interrupts disabled like the MCU.
+ */
+static void callVector(void (*vector)(void))
+{
+    sreg &= ~(1 << SREG_I);
+    uint64_t start = sim.cycles;
+    sim.cycles += ISR_CYCLES;
+    sim.vectorCalls++;
+    sim.inVector++;
+    vector();
+    sim.inVector--;
+    if (!sim.inVector)
+        sim.vectorCycles += sim.cycles - start;
+    sreg |= (1 << SREG_I);
+}
+
+/* interrupts()
+ * ------------
+ * Dispatches pending interrupts in vector priority order.
+ */
+static void interrupts(void)
+{
+    // Bound the loop so a handler that never clears its source cannot hang
+    // the host; the next access will dispatch it again.
+    for (uint8_t i = 0; i < 16 && (sreg & (1 << SREG_I)); i++) {
+        if (sim.pinChangePending && (halHostPCICR & (1 << PCIE2))) {
+            sim.pinChangePending = 0;
+            callVector(halHostVectPcint2);
+        } else if (sim.timer2Pending && (halHostTIMSK2 & (1 << OCIE2A))) {
+            sim.timer2Pending = 0;
+            callVector(halHostVectTimer2CompA);
+        } else if (sim.timerPending && (halHostTIMSK0 & (1 << OCIE0A))) {
+            sim.timerPending = 0;
+            sim.timerTicks++;
+            callVector(halHostVectTimer0CompA);
+        } else if ((spsr & (1 << SPIF)) && (halHostSPCR & (1 << SPIE))) {
+            spsr &= ~(1 << SPIF);
+            callVector(halHostVectSpiStc);
+        } else if ((ucsr0a & (1 << RXC0)) && (halHostUCSR0B & (1 << RXCIE0))) {
+            callVector(halHostVectUsartRx);
+        } else if ((ucsr0a & (1 << UDRE0)) && (halHostUCSR0B & (1 << UDRIE0))) {
+            callVector(halHostVectUsartUdre);
+        } else if ((adcsra & (1 << ADIF)) && (adcsra & (1 << ADIE))) {
+            adcsra &= ~(1 << ADIF);
+            callVector(halHostVectAdc);
+        } else if (!(eecr & (1 << EEPE)) && (eecr & (1 << EERIE))) {
+            callVector(halHostVectEeReady);
+        } else {
+            break;
+        }
+        peripherals();
+    }
+}
+
+/* step()
+ * ------
+ * Advances simulated time and services the simulated hardware.
+ *
+ * cost: number of CPU cycles to advance.
+ */
+static void step(uint32_t cost)
+{
+    if (!sim.initialised)
+        initialise();
+    sim.cycles += cost;
+    service();
+}
+
+/* service()
+ * ---------
+ * Brings peripherals, scenario and interrupts up to the current time.
+ */
+static void service(void)
+{
+    if (sim.inService)
+        return;
+    sim.inService = 1;
+    peripherals();
+    runEvents();
+    sim.inService = 0;
+    interrupts();
+}
+
+/* spin()
+ * ------
+ * Adds a finished busy-wait of the main program to the statistics.
+ *
+ * length: the length of the busy-wait in cycles.
+ */
+static void spin(uint64_t length)
+{
+    sim.spinTotal += length;
+    if (length > sim.spinMax)
+        sim.spinMax = length;
+    if (length > sim.markSpinMax)
+        sim.markSpinMax = length;
+}
+
+/* poll()
+ * ------
+ * Records a register access by the main program. Back to back accesses of the
+ * same flag register with nothing else accessed in between are counted as one
+ * busy-wait.
+ *
+ * reg: the flag register accessed, or NULL for any other register.
+ */
+static void poll(volatile uint8_t* reg)
+{
+    if (sim.inVector)
+        return;
+
+    uint64_t now = sim.cycles - sim.vectorCycles;
+    if (!reg || reg != sim.spinRegister || now - sim.spinLast > SPIN_GAP) {
+        spin(sim.spinLast - sim.spinStart);
+        sim.spinRegister = reg;
+        sim.spinStart = now;
+    }
+    sim.spinLast = now;
+}
+
+volatile uint8_t* halHostPinD(void)
+{
+    step(ACCESS_CYCLES);
+    poll(&pind);
+
+    static const uint8_t colPins[COLS] = { COL_ONE, COL_TWO, COL_THREE, COL_FOUR };
+    static const uint8_t rowPins[ROWS] = { ROW_ONE, ROW_TWO, ROW_THREE };
+
+    uint8_t value = halHostPORTD & halHostDDRD;
+    uint8_t scanning = 0;
+    for (uint8_t col = 0; col < COLS; col++) {
+        if (!(halHostDDRC & halHostPORTC & colPins[col]))
+            continue;
+        scanning = 1;
+        for (uint8_t row = 0; row < ROWS; row++) {
+            if (sim.keys[col][row])
+                value |= rowPins[row];
+        }
+    }
+    if (sim.cycles >= sim.hidBusyUntil)
+        value |= HID_IDLE;
+
+    // Track how often the matrix gets scanned.
+    if (scanning) {
+        if (sim.lastScan && sim.cycles - sim.lastScan > sim.maxScanGap)
+            sim.maxScanGap = sim.cycles - sim.lastScan;
+        sim.lastScan = sim.cycles;
+    }
+
+    pind = value;
+    return &pind;
+}
+
+volatile uint8_t* halHostSpsr(void)
+{
+    step(ACCESS_CYCLES);
+    poll(&spsr);
+    return &spsr;
+}
+
+volatile uint16_t* halHostSpdr(void)
+{
+    step(ACCESS_CYCLES);
+    poll(NULL);
+    spsr &= ~((1 << SPIF) | (1 << WCOL));
+    spdrSlot = SLOT_EMPTY | 0xFF;
+    return &spdrSlot;
+}
+
+volatile uint8_t* halHostUcsr0a(void)
+{
+    step(ACCESS_CYCLES);
+    poll(&ucsr0a);
+    return &ucsr0a;
+}
+
+volatile uint16_t* halHostUdr0(void)
+{
+    step(ACCESS_CYCLES);
+    poll(NULL);
+    ucsr0a &= ~(1 << RXC0);
+    udr0Slot = SLOT_EMPTY | sim.rxData;
+    return &udr0Slot;
+}
+
+volatile uint8_t* halHostAdcsra(void)
+{
+    step(ACCESS_CYCLES);
+    poll(&adcsra);
+    return &adcsra;
+}
+
+volatile uint8_t* halHostEecr(void)
+{
+    step(ACCESS_CYCLES);
+    poll(&eecr);
+    return &eecr;
+}
+
+volatile uint16_t* halHostEedr(void)
+{
+    step(ACCESS_CYCLES);
+    poll(NULL);
+    eedrSlot = SLOT_EMPTY | sim.eedr;
+    return &eedrSlot;
+}
+
+volatile uint8_t* halHostSreg(void)
+{
+    step(ACCESS_CYCLES);
+    poll(NULL);
+    return &sreg;
+}
+
+/* sei()
+ * -----
+ * Enables global interrupts and dispatches any that are pending.
+ */
+void sei(void)
+{
+    sreg |= (1 << SREG_I);
+    step(1);
+    poll(NULL);
+}
+
+/* cli()
+ * -----
+ * Disables global interrupts.
+ */
+void cli(void)
+{
+    step(1);
+    poll(NULL);
+    sreg &= ~(1 << SREG_I);
+}
+
+/* sleep_mode()
+ * ------------
+ * Sleeps (idle mode) until the next interrupt has been handled.
+ */
+void sleep_mode(void)
+{
+    poll(NULL);
+    uint32_t calls = sim.vectorCalls;
+    while (calls == sim.vectorCalls && (sreg & (1 << SREG_I)))
+        step(1);
+}
+
+/* halHostDelayCycles()
+ * --------------------
+ * Busy-waits for the specified number of simulated CPU cycles while still
+ * servicing peripherals and interrupts.
+ *
+ * cycles: the number of cycles to wait.
+ */
+void halHostDelayCycles(uint32_t cycles)
+{
+    uint64_t start = sim.cycles - sim.vectorCycles;
+    while (cycles) {
+        uint32_t chunk = cycles < 64 ? cycles : 64;
+        step(chunk);
+        cycles -= chunk;
+    }
+    if (!sim.inVector)
+        spin(sim.cycles - sim.vectorCycles - start);
+}
+
+/* halHostCycles()
+ * ---------------
+ * Returns: the number of CPU cycles simulated so far.
+ */
+uint64_t halHostCycles(void)
+{
+    return sim.cycles;
+}
+
+/* halHostMillis()
+ * ---------------
+ * Returns: the simulated time in milliseconds.
+ */
+uint32_t halHostMillis(void)
+{
+    return (uint32_t)(sim.cycles * 1000 / F_CPU);
+}
+
+/* halHostSetKey()
+ * ---------------
+ * Presses or releases a key of the simulated matrix.
+ *
+ * col: the column of the key.
+ * row: the row of the key.
+ * pressed: 1 to press the key, 0 to release it.
+ */
+void halHostSetKey(uint8_t col, uint8_t row, uint8_t pressed)
+{
+    if (col >= COLS || row >= ROWS)
+        return;
+    if (pressed && !sim.keys[col][row]) {
+        sim.pressCycle = sim.cycles;
+        sim.pressPending = 1;
+    }
+    sim.keys[col][row] = pressed;
+}
+
+/* halHostUartInject()
+ * -------------------
+ * Queues bytes to arrive on the USART receiver at the configured baud rate.
+ *
+ * bytes: the bytes to receive.
+ * length: the number of bytes.
+ */
+void halHostUartInject(const uint8_t* bytes, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++) {
+        uint16_t next = (sim.rxHead + 1) % RX_QUEUE;
+        if (next == sim.rxTail)
+            return;
+        sim.rxQueue[sim.rxHead] = bytes[i];
+        sim.rxHead = next;
+    }
+}
+
+/* halHostSetLight()
+ * -----------------
+ * Sets the ADC value returned by the light sensor.
+ *
+ * adcValue: the value for the next conversion.
+ */
+void halHostSetLight(uint16_t adcValue)
+{
+    sim.light = adcValue;
+}
+
+/* halHostLedWrite()
+ * -----------------
+ * Accounts for a WS2812 bit stream, which takes 1.25us per bit with
+ * interrupts disabled.
+ *
+ * data: the GRB bytes sent.
+ * length: the number of bytes.
+ */
+void halHostLedWrite(const uint8_t* data, uint16_t length)
+{
+    (void)data;
+    sim.ledBytes += length;
+    sim.cycles += (uint64_t)length * 8 * (F_CPU / 800000);
+}
+
+#endif
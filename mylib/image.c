@@ -0,0 +1,187 @@
+/*
+ * image.c
+ *
+ * Team 01 ENGG2800
+ */
+
+#include "image.h"
+#include "memory.h"
+#include "hal.h"
+
+// Index of each field in the header of a bank. The CRC covers the image then
+// the rest of the header.
+#define HEADER_VERSION 0
+#define HEADER_GENERATION 1
+#define HEADER_LENGTH 2
+#define HEADER_CRC 4
+
+// Bank holding the current image, its generation, which goes up by one for
+// every image written, its layout version and its length.
+static uint8_t current;
+static uint8_t generation;
+static uint8_t version;
+static uint16_t length;
+
+// Length and CRC of the new image being written to the other bank.
+static uint16_t newLength;
+static uint16_t newCrc;
+
+/* bankAddress()
+ * -------------
+ * Gets the EEPROM address of a bank.
+ *
+ * bank: the bank, 0 or 1.
+ *
+ * Returns: the address of the header of the bank.
+ */
+static uint16_t bankAddress(uint8_t bank)
+{
+    return IMAGE_ADDRESS + bank * IMAGE_BANK_SIZE;
+}
+
+/* checkBank()
+ * -----------
+ * Checks the image in a bank with one pass of the CRC.
+ *
+ * bank: the bank to check.
+ * header: the header of the bank.
+ *
+ * Returns: 1 if the bank holds a valid image, otherwise 0.
+ */
+static uint8_t checkBank(uint8_t bank, uint8_t* header)
+{
+    uint16_t address = bankAddress(bank) + IMAGE_HEADER;
+    uint16_t length = (header[HEADER_LENGTH] << 8) | header[HEADER_LENGTH + 1];
+    if (!header[HEADER_VERSION] || header[HEADER_VERSION] > IMAGE_VERSION
+        || length > IMAGE_CAPACITY)
+        return 0;
+
+    uint16_t crc = IMAGE_CRC_INIT;
+    for (uint16_t i = 0; i < length; i++)
+        crc = _crc_xmodem_update(crc, eepromRead(address + i));
+    for (uint8_t i = 0; i < HEADER_CRC; i++)
+        crc = _crc_xmodem_update(crc, header[i]);
+    return crc == ((header[HEADER_CRC] << 8) | header[HEADER_CRC + 1]);
+}
+
+/* imageLoad()
+ * -----------
+ * Finds the bank with the newest valid image. The bank with the newer
+ * generation is checked first and the other bank only if it fails, which it
+ * does if its writing was cut short by a power loss. With no valid image,
+ * the first image is written to bank 0.
+ *
+ * Returns: 1 if a valid image was found, otherwise 0.
+ */
+uint8_t imageLoad(void)
+{
+    uint8_t header[IMAGE_BANKS][IMAGE_HEADER];
+    for (uint8_t bank = 0; bank < IMAGE_BANKS; bank++) {
+        for (uint8_t i = 0; i < IMAGE_HEADER; i++)
+            header[bank][i] = eepromRead(bankAddress(bank) + i);
+    }
+
+    // Generations wrap around, so compare the difference.
+    int8_t newer = header[1][HEADER_GENERATION] - header[0][HEADER_GENERATION];
+    uint8_t newest = newer > 0;
+    for (uint8_t i = 0; i < IMAGE_BANKS; i++) {
+        uint8_t bank = i ? !newest : newest;
+        if (checkBank(bank, header[bank])) {
+            current = bank;
+            generation = header[bank][HEADER_GENERATION];
+            version = header[bank][HEADER_VERSION];
+            length = (header[bank][HEADER_LENGTH] << 8)
+                | header[bank][HEADER_LENGTH + 1];
+            return 1;
+        }
+    }
+
+    current = IMAGE_BANKS - 1;
+    generation = 0;
+    version = IMAGE_VERSION;
+    length = 0;
+    return 0;
+}
+
+/* imageVersion()
+ * --------------
+ * Returns: the layout version of the current image.
+ */
+uint8_t imageVersion(void)
+{
+    return version;
+}
+
+/* imageAddress()
+ * --------------
+ * Returns: the EEPROM address of the current image.
+ */
+uint16_t imageAddress(void)
+{
+    return bankAddress(current) + IMAGE_HEADER;
+}
+
+/* imageLength()
+ * -------------
+ * Returns: the length of the current image, 0 if there is none.
+ */
+uint16_t imageLength(void)
+{
+    return length;
+}
+
+/* imageBegin()
+ * ------------
+ * Starts writing a new image to the bank not holding the current image, so
+ * the current image is left whole until the new one is committed.
+ */
+void imageBegin(void)
+{
+    newLength = 0;
+    newCrc = IMAGE_CRC_INIT;
+}
+
+/* imageWrite()
+ * ------------
+ * Writes the next byte of the new image. The caller makes sure the image is
+ * no longer than IMAGE_CAPACITY.
+ *
+ * byte: the byte to write.
+ *
+ * Returns: the EEPROM address the byte is written to.
+ */
+uint16_t imageWrite(uint8_t byte)
+{
+    uint16_t address = bankAddress(!current) + IMAGE_HEADER + newLength++;
+    newCrc = _crc_xmodem_update(newCrc, byte);
+    eepromWrite(address, byte);
+    return address;
+}
+
+/* imageCommit()
+ * -------------
+ * Writes the header of the new image so it replaces the current image.
+ * Queued writes are programmed in order and the CRC is written last, so the
+ * new image only becomes valid once all of it is in EEPROM.
+ */
+void imageCommit(void)
+{
+    uint8_t header[IMAGE_HEADER];
+    header[HEADER_VERSION] = IMAGE_VERSION;
+    header[HEADER_GENERATION] = generation + 1;
+    header[HEADER_LENGTH] = newLength >> 8;
+    header[HEADER_LENGTH + 1] = newLength;
+    for (uint8_t i = 0; i < HEADER_CRC; i++)
+        newCrc = _crc_xmodem_update(newCrc, header[i]);
+    header[HEADER_CRC] = newCrc >> 8;
+    header[HEADER_CRC + 1] = newCrc;
+
+    uint16_t address = bankAddress(!current);
+    for (uint8_t i = 0; i < IMAGE_HEADER; i++)
+        eepromWrite(address + i, header[i]);
+
+    current = !current;
+    generation++;
+    version = IMAGE_VERSION;
+    length = newLength;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+/*
+ * image.h
+ *
+ * Team 01 ENGG2800
+ */
+
+#pragma once
+
+#include "addresses.h"
+#include <stdint.h>
+
+// Each bank starts with a header of the layout version, generation (1 byte),
+// length of the image (2 bytes) and a CRC-16 (2 bytes), followed by the
+// image. Multi-byte fields are stored high byte first.
+#define IMAGE_VERSION 3 // Layout version of new images, older can be read.
+#define IMAGE_HEADER 6 // Bytes in the header of a bank.
+#define IMAGE_CRC_INIT 0xFFFF // Initial CRC-16 (CCITT) value.
+#define IMAGE_BANKS 2 // Number of banks.
+#define IMAGE_CAPACITY (IMAGE_BANK_SIZE - IMAGE_HEADER) // Max image bytes.
+
+// Finds the newest bank with a valid image.
+uint8_t imageLoad(void);
+
+// Returns the layout version of the current image.
+uint8_t imageVersion(void);
+
+// Returns the EEPROM address of the current image.
+uint16_t imageAddress(void);
+
+// Returns the length of the current image, 0 if there is none.
+uint16_t imageLength(void);
+
+// Starts writing a new image to the bank not holding the current image.
+void imageBegin(void);
+
+// Writes the next byte of the new image and returns its EEPROM address.
+uint16_t imageWrite(uint8_t byte);
+
+// Writes the header of the new image so it replaces the current image.
+void imageCommit(void);
\ No newline at end of file
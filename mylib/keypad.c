@@ -5,7 +5,7 @@
  */
 
 #include "keypad.h"
-#include <avr/io.h>
+#include "hal.h"
 #include <stdlib.h>
 
 /* keyPadInit()
@@ -21,48 +21,95 @@ void keyPadInit(void)
     DDRC |= COL_ONE | COL_TWO | COL_THREE | COL_FOUR;
 }
 
-/* keyPress()
- * ----------
- * Gets the matrix location of the key pressed.
- *
- * key: a pointer to an array where the key location will be stored.
- *
- * Returns: a pointer to an array with 0th index as the column and 1st index
- *     as the row of the key pressed.
+// Integrating debounce counter for every key, only touched by keyScan()
+// from the timer interrupt.
+static uint8_t debounce[COLS][ROWS];
+
+// Bitmap of debounced key states indexed by KEY_INDEX().
+static uint16_t keyState;
+
+// Single producer (timer interrupt), single consumer (main loop) queue of key
+// events. Each index is only written by one side so no locking is needed.
+static volatile uint8_t eventQueue[KEY_EVENT_QUEUE];
+static volatile uint8_t eventHead;
+static volatile uint8_t eventTail;
+
+/* keyScan()
+ * ---------
+ * Samples every key of the matrix once and queues a press or release event
+ * for each key whose debounced state changed. Called from the timer 0
+ * interrupt every SCAN_INTERVAL ms.
  */
-uint8_t* keyPress(uint8_t* key)
+void keyScan(void)
 {
-    uint8_t row[ROWS] = { ROW_ONE, ROW_TWO, ROW_THREE };
-    uint8_t col[COLS] = { COL_ONE, COL_TWO, COL_THREE, COL_FOUR };
-
-    int num = 0;
-    uint8_t keysPressed = 0;
+    static const uint8_t row[ROWS] = { ROW_ONE, ROW_TWO, ROW_THREE };
+    static const uint8_t col[COLS] = { COL_ONE, COL_TWO, COL_THREE, COL_FOUR };
 
     // Iterate through all columns of keypad.
     for (uint8_t i = 0; i < COLS; i++) {
         PORTC |= col[i]; // Set column high.
+        // Let the row lines settle through the switches and the pin
+        // synchroniser before sampling them.
+        _delay_us(KEY_SETTLE_DELAY);
+        uint8_t rows = PIND;
+        PORTC &= ~(col[i]); // Set column low.
 
-        // Check all rows for high input to see if any switch is pressed.
         for (uint8_t j = 0; j < ROWS; j++) {
-            if (PIND & row[j]) {
-                key[0] = i;
-                key[1] = j;
-                keysPressed++;
+            // Integrate the raw sample towards pressed or released.
+            if (rows & row[j]) {
+                if (debounce[i][j] < DEBOUNCE_COUNT)
+                    debounce[i][j]++;
+            } else if (debounce[i][j]) {
+                debounce[i][j]--;
             }
-        }
 
-        PORTC &= ~(col[i]); // Set column low.
-    }
+            // Only change state once the counter saturates.
+            uint16_t key = 1 << KEY_INDEX(i, j);
+            uint8_t event;
+            if (!(keyState & key) && debounce[i][j] == DEBOUNCE_COUNT)
+                event = KEY_EVENT_PRESS;
+            else if ((keyState & key) && !debounce[i][j])
+                event = 0;
+            else
+                continue;
 
-    // Ensure only 1 key is pressed.
-    if (keysPressed == 1) {
-        return key;
+            // Drop the event if the main loop has fallen too far behind and
+            // retry on the next scan.
+            uint8_t next = (eventHead + 1) & (KEY_EVENT_QUEUE - 1);
+            if (next == eventTail)
+                continue;
+
+            keyState ^= key;
+            eventQueue[eventHead] = event | KEY_INDEX(i, j);
+            eventHead = next;
+        }
     }
+}
+
+/* keyEvent()
+ * ----------
+ * Gets the next debounced key event queued by keyScan().
+ *
+ * key: a pointer to an array where the key location will be stored.
+ *
+ * Returns: KEY_PRESSED or KEY_RELEASED with the location of the key stored
+ *     in key as [column, row], or NO_KEY_EVENT if the queue is empty.
+ */
+uint8_t keyEvent(uint8_t* key)
+{
+    if (eventTail == eventHead)
+        return NO_KEY_EVENT;
+
+    uint8_t event = eventQueue[eventTail];
+    eventTail = (eventTail + 1) & (KEY_EVENT_QUEUE - 1);
+
+    uint8_t index = event & ~KEY_EVENT_PRESS;
+    key[COL] = index / ROWS;
+    key[ROW] = index % ROWS;
 
-    // Return the invalid key press if 0 or more than 1 key is pressed.
-    key[0] = IGNORE_PRESS;
-    key[1] = IGNORE_PRESS;
-    return key;
+    if (event & KEY_EVENT_PRESS)
+        return KEY_PRESSED;
+    return KEY_RELEASED;
 }
 
 /* keyLocation()
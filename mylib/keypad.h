@@ -21,16 +21,33 @@
 
 #define ROWS 3 // Total number of rows in keypad.
 #define COLS 4 // Total number of columns in keypad.
+#define KEYS (COLS * ROWS) // Total number of keys in keypad.
+#define KEY_INDEX(col, row) ((col) * ROWS + (row)) // Bit of key in bitmaps.
+#define KEY_NUMBER(col, row) ((row) * COLS + (col) + 1) // See keyLocation().
 #define IGNORE_PRESS 4 // Default row or columns for invalid key presses.
 
-#define COL 0 // Index for column in array returned by keyPress().
-#define ROW 1 // Index for row in array returned by keyPress().
+#define COL 0 // Index for column in array returned by keyEvent().
+#define ROW 1 // Index for row in array returned by keyEvent().
+
+#define SCAN_INTERVAL 1 // Time in ms between scans of the keypad matrix.
+#define DEBOUNCE_COUNT 5 // Matching scans needed to change a key's state.
+#define KEY_SETTLE_DELAY 1 // Time in us for a row to settle after a column is set.
+#define KEY_EVENT_QUEUE 16 // Size of key event queue, must be a power of 2.
+#define KEY_EVENT_PRESS (1 << 7) // Bit set in queued events for presses.
+
+// Key events returned by keyEvent().
+#define NO_KEY_EVENT 0
+#define KEY_PRESSED 1
+#define KEY_RELEASED 2
 
 // Initialises the Pins and Ports for the keypad.
 void keyPadInit(void);
 
-// Returns the matrix location of the key pressed.
-uint8_t* keyPress(uint8_t* key);
+// Samples the keypad and queues debounced key events. Called from timer 0.
+void keyScan(void);
+
+// Returns the next debounced key event and stores the key location.
+uint8_t keyEvent(uint8_t* key);
 
 // Returns the matrix location of key pressed based on the keyNum provided.
 uint8_t* keyLocation(uint8_t location[2], uint8_t keyNum);
\ No newline at end of file
@@ -5,10 +5,11 @@
  */
 
 #include "lcd.h"
+#include "spi.h"
 #include "st7735.h"
-#include <avr/io.h>
+#include "timer.h"
+#include "hal.h"
 #include <string.h>
-#include <util/delay.h>
 
 // Initialise global variable for LCD struct to make it easier manipulate LCD
 // from macrolyze.c.
@@ -20,116 +21,569 @@ struct signal Rs = { .ddr = &DDRD, .port = &PORTD, .pin = 7 }; // Reset.
 // LCD struct.
 struct st7735 Lcd = { .cs = &Cs, .bl = &Bl, .dc = &Dc, .rs = &Rs };
 
+// Steps of starting the LCD, each taken by lcdReady() once the delay after
+// the step before has passed.
+#define START_RESET_LOW 0 // Pull the reset pin low.
+#define START_RESET_HIGH 1 // Let the reset pin go high again.
+#define START_COMMANDS 2 // Send the next command of INIT_ST7735B.
+#define START_DONE 3 // The LCD can be drawn on.
+
+static uint8_t startStep;
+static uint32_t startTime; // Time the next step can be taken.
+static const uint8_t* startCommand; // Next command of INIT_ST7735B.
+static uint8_t startCommands; // Number of commands left to send.
+
+// A rectangle of pixels, including its last column and row. A box with x0
+// after x1 is empty.
+struct Box {
+    uint8_t x0;
+    uint8_t x1;
+    uint8_t y0;
+    uint8_t y1;
+};
+
+// A line of text on the LCD. The text wanted on the line is drawn over the
+// text shown a character at a time by lcdService(), so only the characters
+// that changed are repainted, then what is left of the old text is cleared.
+struct TextLine {
+    struct TextLayout shown; // Length is the number of characters drawn.
+    char shownText[MAX_TEXT];
+    struct TextLayout wanted;
+    char wantedText[MAX_TEXT];
+    struct Box dirty; // Pixels of old text still to clear.
+};
+
+static struct TextLine lines[TEXT_LINES];
+
+// Regions of the screen drawn by the render queue, after the lines of text.
+#define REGION_FILL TEXT_LINES // The whole screen.
+#define REGION_ICON (TEXT_LINES + 1) // The 'connected' symbol.
+#define REGIONS (TEXT_LINES + 2)
+
+#define FILL_ROWS (RENDER_PIXELS / MAX_X) // Rows filled by each step.
+
+// Regions waiting to be drawn by lcdService(), in the order they were first
+// asked for. A region is only queued once, so a newer command for it replaces
+// the one waiting.
+static uint8_t queue[REGIONS];
+static uint8_t queued;
+
+// Fill waiting to be drawn and the next row of it to fill.
+static uint16_t fillColour;
+static uint8_t fillConnected;
+static uint8_t fillRow;
+
+// Colour of the 'connected' symbol waiting to be drawn.
+static uint16_t iconColour;
+
 /* lcdInit()
  * ---------
- * Initialises the LCD.
+ * Initialises the LCD pins and SPI and starts the hardware reset of the LCD.
+ * The rest is done by lcdReady() from the main program, instead of waiting
+ * for the LCD here.
  */
 void lcdInit(void)
 {
     // Initialise LCD.
-    ST7735_Init(&Lcd);
+    ST7735_Pins_Init(&Lcd);
+    ST7735_SPI_Init();
+    *(Rs.port) |= (1 << Rs.pin);
+    *(Rs.ddr) |= (1 << Rs.pin);
+    startStep = START_RESET_LOW;
+    startTime = getCurrentTime() + LCD_RESET_DELAY;
 
     // Set LCD brightness to 5.
     OCR1A = 125;
 }
 
+/* lcdReady()
+ * ----------
+ * Takes the next step of starting the LCD once the delay after the last step
+ * has passed, the same steps ST7735_Init() takes with blocking delays.
+ * Called from the main program until it returns 1.
+ *
+ * Returns: 1 once the LCD has started and can be drawn on, otherwise 0.
+ */
+uint8_t lcdReady(void)
+{
+    if (startStep == START_DONE)
+        return 1;
+
+    uint32_t now = getCurrentTime();
+    if (now < startTime)
+        return 0;
+
+    if (startStep == START_RESET_LOW) {
+        *(Rs.port) &= ~(1 << Rs.pin);
+        startTime = now + LCD_RESET_DELAY;
+        startStep = START_RESET_HIGH;
+    } else if (startStep == START_RESET_HIGH) {
+        *(Rs.port) |= (1 << Rs.pin);
+        startCommand = INIT_ST7735B;
+        startCommands = pgm_read_byte(startCommand++);
+        startStep = START_COMMANDS;
+    } else if (startCommands) {
+        // Each command is the number of arguments, the delay after it, the
+        // command and its arguments.
+        uint8_t args = pgm_read_byte(startCommand++);
+        uint8_t delay = pgm_read_byte(startCommand++);
+        spiAcquire(SPI_LCD);
+        ST7735_CommandSend(&Lcd, pgm_read_byte(startCommand++));
+        while (args--)
+            ST7735_Data8BitsSend(&Lcd, pgm_read_byte(startCommand++));
+        spiRelease();
+        startCommands--;
+        startTime = now + delay + 1; // Wait at least the whole delay.
+    } else {
+        startStep = START_DONE;
+    }
+    return startStep == START_DONE;
+}
+
+/* connectedSymbol()
+ * -----------------
+ * Draws the 'connected' symbol on the LCD. The LCD must own the SPI bus.
+ *
+ * colour: the 16 bit colour of the symbol.
+ */
+static void connectedSymbol(uint16_t colour)
+{
+    // Draw bottom and top horizontal lines.
+    ST7735_DrawRectangle(&Lcd, 130, 144, 85, 85, colour);
+    ST7735_DrawRectangle(&Lcd, 130, 144, 101, 101, colour);
+
+    // Draw left and right vertical lines.
+    ST7735_DrawRectangle(&Lcd, 130, 130, 86, 99, colour);
+    ST7735_DrawRectangle(&Lcd, 145, 145, 86, 99, colour);
+
+    // Draw a horizontal line on the left.
+    ST7735_DrawRectangle(&Lcd, 120, 129, 93, 93, colour);
+
+    // Draw two horizontal lines on the right.
+    ST7735_DrawRectangle(&Lcd, 145, 153, 89, 89, colour);
+    ST7735_DrawRectangle(&Lcd, 145, 153, 96, 96, colour);
+}
+
+/* queueRegion()
+ * -------------
+ * Adds a region to the end of the render queue unless it is already waiting.
+ *
+ * region: the line of text, REGION_FILL or REGION_ICON.
+ */
+static void queueRegion(uint8_t region)
+{
+    for (uint8_t i = 0; i < queued; i++) {
+        if (queue[i] == region)
+            return;
+    }
+    queue[queued++] = region;
+}
+
 /* fillScreen()
  * ------------
- * Clears the LCD screen and displays the 'connected' icon if necessary.
+ * Queues the LCD screen to be cleared and the 'connected' icon to be displayed
+ * if necessary. The fill replaces everything else waiting to be drawn.
+ * Nothing is drawn until the LCD has started, see lcdReady().
  *
  * colour: the colour to fill the screen with.
  * connected: a 1 or 0 to indicate whether connected icon should be displayed.
  */
 void fillScreen(uint16_t colour, uint8_t connected)
 {
-    // Increase SPI CLK speed.
-    SPCR &= ~(1 << SPR0);
-    SPSR |= (1 << SPI2X);
+    if (startStep != START_DONE)
+        return;
 
-    ST7735_ClearScreen(&Lcd, colour);
-    if (connected) {
-        drawConnected(WHITE);
+    queue[0] = REGION_FILL;
+    queued = 1;
+    fillColour = colour;
+    fillConnected = connected;
+    fillRow = 0;
+
+    // The text that was on the screen is gone.
+    for (uint8_t line = 0; line < TEXT_LINES; line++) {
+        lines[line].shown.length = 0;
+        lines[line].wanted.length = 0;
+        lines[line].dirty.x0 = 1;
+        lines[line].dirty.x1 = 0;
     }
+}
 
-    // Revert SPI CLK speed back to normal.
-    SPSR &= ~(1 << SPI2X);
-    SPCR |= (1 << SPR0);
+/* fillStep()
+ * ----------
+ * Fills the next few rows of the screen, then draws the 'connected' symbol if
+ * necessary. The LCD must own the SPI bus.
+ *
+ * Returns: 1 once the fill is drawn, otherwise 0.
+ */
+static uint8_t fillStep(void)
+{
+    if (fillRow < MAX_Y) {
+        uint8_t last = fillRow + FILL_ROWS - 1;
+        if (last > SIZE_Y)
+            last = SIZE_Y;
+        ST7735_DrawRectangle(&Lcd, 0, SIZE_X, fillRow, last, fillColour);
+        fillRow += FILL_ROWS;
+        return 0;
+    }
+    if (fillConnected) {
+        connectedSymbol(WHITE);
+    }
+    return 1;
 }
 
-/* drawText()
+/* nextCell()
  * ----------
- * Displays text on the LCD.
+ * Places the cell of the next character of a line of text, wrapping to the
+ * next row at x 2 when it runs off the screen as ST7735_DrawString() does.
+ * The cell includes the space after the character.
  *
- * text: the text to display.
- * x: the position in x-axis for where to display the text.
- * y: the position in y-axis for where to display the text.
+ * size: the font size of the text.
+ * x: the x position after the last cell, moved past this cell.
+ * y: the y position of the last cell, moved to the next row on a wrap.
+ * cell: the box to place the cell in, clipped to the screen.
+ *
+ * Returns: 1 if the cell is on the screen, otherwise 0.
  */
-void drawText(char* text, uint8_t x, uint8_t y)
+static uint8_t nextCell(uint8_t size, uint8_t* x, uint8_t* y, struct Box* cell)
 {
-    // Increase SPI CLK speed so divider is 2.
-    SPCR &= ~(1 << SPR0);
-    SPSR |= (1 << SPI2X);
+    uint8_t width = (CHARS_COLS_LEN << (size & 0x01)) + 1;
+    uint8_t height = CHARS_ROWS_LEN << (size >> 7);
+    if (*x + CHARS_COLS_LEN + (size & 0x0F) > MAX_X) {
+        *x = 2;
+        *y += height;
+    }
+    if (*y > SIZE_Y)
+        return 0;
+
+    cell->x0 = *x;
+    cell->x1 = *x + width - 1 > SIZE_X ? SIZE_X : *x + width - 1;
+    cell->y0 = *y;
+    cell->y1 = *y + height - 1 > SIZE_Y ? SIZE_Y : *y + height - 1;
+    *x += width;
+    return 1;
+}
 
-    // Get text length and check if its valid.
-    uint8_t textLength = strlen(text);
-    if (textLength > 30) {
+/* eraseOutside()
+ * --------------
+ * Clears the part of a box outside another box, as up to four rectangles.
+ *
+ * box: the box to clear.
+ * keep: the box to leave as it is, because it is about to be drawn over.
+ */
+static void eraseOutside(const struct Box* box, const struct Box* keep)
+{
+    if (keep->x0 > keep->x1 || keep->x0 > box->x1 || keep->x1 < box->x0
+        || keep->y0 > box->y1 || keep->y1 < box->y0) {
+        ST7735_DrawRectangle(&Lcd, box->x0, box->x1, box->y0, box->y1, BLACK);
         return;
     }
 
+    uint8_t y0 = box->y0;
+    uint8_t y1 = box->y1;
+    if (keep->y0 > y0) {
+        ST7735_DrawRectangle(&Lcd, box->x0, box->x1, y0, keep->y0 - 1, BLACK);
+        y0 = keep->y0;
+    }
+    if (keep->y1 < y1) {
+        ST7735_DrawRectangle(&Lcd, box->x0, box->x1, keep->y1 + 1, y1, BLACK);
+        y1 = keep->y1;
+    }
+    if (keep->x0 > box->x0)
+        ST7735_DrawRectangle(&Lcd, box->x0, keep->x0 - 1, y0, y1, BLACK);
+    if (keep->x1 < box->x1)
+        ST7735_DrawRectangle(&Lcd, keep->x1 + 1, box->x1, y0, y1, BLACK);
+}
+
+/* layoutText()
+ * ------------
+ * Works out the font size of text from its length and where it starts, so
+ * text drawn again and again is only laid out once.
+ *
+ * layout: the layout to fill in.
+ * length: the number of characters of the text.
+ * x: the position in x-axis of the text, or of its centre if centre is set.
+ * y: the position in y-axis for where to display the text.
+ * centre: whether the text is centred on x.
+ */
+void layoutText(struct TextLayout* layout, uint8_t length, uint8_t x,
+    uint8_t y, uint8_t centre)
+{
     // Determine size for text.
     uint8_t textSize = X1; // Default size is X1.
-    if (textLength < 14) {
+    if (length < 14) {
         textSize = X3;
-    } else if (textLength < 25) {
+    } else if (length < 25) {
         textSize = X2;
     }
 
-    ST7735_SetPosition(x, y);
-    ST7735_DrawString(&Lcd, text, WHITE, textSize);
+    // Characters are taken as 10 pixels wide at X3 and 6 otherwise.
+    if (centre)
+        x -= length * (textSize == X3 ? 5 : 3);
 
-    // Revert SPI CLK speed back to normal.
-    SPSR &= ~(1 << SPI2X);
-    SPCR |= (1 << SPR0);
+    layout->x = x;
+    layout->y = y;
+    layout->size = textSize;
+    layout->length = length;
 }
 
-/* drawConnected()
- * ---------------
- * Draws the 'connected' symbol on the LCD.
+/* coverText()
+ * -----------
+ * Finds the box text covers when it is drawn on a single row.
  *
- * colour: the 16 bit colour of the symbol.
+ * layout: the layout of the text.
+ * cover: the box to fill in, left empty if the text wraps or is empty.
  */
-void drawConnected(uint16_t colour)
+static void coverText(const struct TextLayout* layout, struct Box* cover)
 {
-    // Draw bottom horizontal line.
-    for (uint8_t x = 130; x < 145; x++) {
-        ST7735_DrawPixel(&Lcd, x, 85, colour);
+    uint8_t x = layout->x;
+    uint8_t y = layout->y;
+    struct Box cell;
+    cover->x0 = 1;
+    cover->x1 = 0;
+    for (uint8_t i = 0; i < layout->length; i++) {
+        if (!nextCell(layout->size, &x, &y, &cell) || cell.y0 != layout->y) {
+            cover->x0 = 1;
+            cover->x1 = 0;
+            return;
+        }
+        if (!i)
+            *cover = cell;
+        cover->x1 = cell.x1;
     }
+}
 
-    // Draw top horizontal line.
-    for (uint8_t x = 130; x < 145; x++) {
-        ST7735_DrawPixel(&Lcd, x, 101, colour);
+/* addDirty()
+ * ----------
+ * Stops counting the last characters shown on a line as drawn and adds their
+ * cells to the pixels the line still has to clear.
+ *
+ * line: the line of text.
+ * first: the first character to take off.
+ */
+static void addDirty(struct TextLine* line, uint8_t first)
+{
+    struct TextLayout* shown = &line->shown;
+    struct Box* dirty = &line->dirty;
+    uint8_t x = shown->x;
+    uint8_t y = shown->y;
+    struct Box cell;
+    for (uint8_t i = 0; i < shown->length; i++) {
+        if (!nextCell(shown->size, &x, &y, &cell))
+            break;
+        if (i < first)
+            continue;
+        if (dirty->x0 > dirty->x1) {
+            *dirty = cell;
+            continue;
+        }
+        if (cell.x0 < dirty->x0)
+            dirty->x0 = cell.x0;
+        if (cell.x1 > dirty->x1)
+            dirty->x1 = cell.x1;
+        if (cell.y0 < dirty->y0)
+            dirty->y0 = cell.y0;
+        if (cell.y1 > dirty->y1)
+            dirty->y1 = cell.y1;
     }
+    if (shown->length > first)
+        shown->length = first;
+}
 
-    // Draw left vertical line.
-    for (uint8_t y = 86; y < 100; y++) {
-        ST7735_DrawPixel(&Lcd, 130, y, colour);
+/* eraseDirty()
+ * ------------
+ * Clears the next few rows of the old text a line still has to clear, except
+ * where the new text is about to be drawn. Characters already drawn in the
+ * rows cleared are drawn again. The LCD must own the SPI bus.
+ *
+ * line: the line of text.
+ * cover: the box the new text covers, see coverText().
+ */
+static void eraseDirty(struct TextLine* line, const struct Box* cover)
+{
+    struct Box band = line->dirty;
+    uint16_t rows = RENDER_PIXELS / (band.x1 - band.x0 + 1);
+    if (band.y1 - band.y0 >= rows)
+        band.y1 = band.y0 + rows - 1;
+    eraseOutside(&band, cover);
+
+    if (band.y1 == line->dirty.y1) {
+        line->dirty.x0 = 1;
+        line->dirty.x1 = 0;
+    } else {
+        line->dirty.y0 = band.y1 + 1;
     }
-    // Draw right vertical line.
-    for (uint8_t y = 86; y < 100; y++) {
-        ST7735_DrawPixel(&Lcd, 145, y, colour);
+
+    // Characters inside the cover were left alone.
+    if (cover->x0 <= cover->x1)
+        return;
+    uint8_t x = line->shown.x;
+    uint8_t y = line->shown.y;
+    struct Box cell;
+    for (uint8_t i = 0; i < line->shown.length; i++) {
+        if (!nextCell(line->shown.size, &x, &y, &cell))
+            break;
+        if (cell.x0 <= band.x1 && cell.x1 >= band.x0 && cell.y0 <= band.y1
+            && cell.y1 >= band.y0) {
+            line->shown.length = i;
+            break;
+        }
     }
+}
 
-    // Draw a horizontal line on the left.
-    for (uint8_t x = 120; x < 130; x++) {
-        ST7735_DrawPixel(&Lcd, x, 93, colour);
+/* textStep()
+ * ----------
+ * Takes the next step of drawing the text wanted on a line: the next
+ * character that is not shown yet, or a few rows of the old text to clear.
+ * Old text is cleared after the new text is drawn, except under text that
+ * wraps, where it is cleared first. The LCD must own the SPI bus.
+ *
+ * line: the line of text.
+ *
+ * Returns: 1 once the line shows the text wanted, otherwise 0.
+ */
+static uint8_t textStep(struct TextLine* line)
+{
+    struct TextLayout* shown = &line->shown;
+    struct TextLayout* wanted = &line->wanted;
+
+    // Text that moves is drawn again from its first character, and characters
+    // past the end of the new text are cleared.
+    if (shown->x != wanted->x || shown->y != wanted->y
+        || shown->size != wanted->size) {
+        addDirty(line, 0);
+        shown->x = wanted->x;
+        shown->y = wanted->y;
+        shown->size = wanted->size;
     }
+    addDirty(line, wanted->length);
 
-    // Draw two horizontal lines on the right.
-    for (uint8_t x = 145; x < 154; x++) {
-        ST7735_DrawPixel(&Lcd, x, 89, colour);
+    struct Box cover;
+    coverText(wanted, &cover);
+    uint8_t dirty = line->dirty.x0 <= line->dirty.x1;
+    if (dirty && cover.x0 > cover.x1) {
+        eraseDirty(line, &cover);
+        return 0;
+    }
+
+    // Draw the first character that changed as one window.
+    uint8_t x = wanted->x;
+    uint8_t y = wanted->y;
+    struct Box cell;
+    for (uint8_t i = 0; i < wanted->length; i++) {
+        if (!nextCell(wanted->size, &x, &y, &cell))
+            break;
+        if (i < shown->length && line->shownText[i] == line->wantedText[i])
+            continue;
+        ST7735_SetPosition(cell.x0, cell.y0);
+        ST7735_DrawChar(&Lcd, line->wantedText[i], WHITE, BLACK, wanted->size);
+        line->shownText[i] = line->wantedText[i];
+        if (i == shown->length)
+            shown->length++;
+        return 0;
+    }
+
+    if (dirty) {
+        eraseDirty(line, &cover);
+        return 0;
+    }
+    return 1;
+}
+
+/* drawLayout()
+ * ------------
+ * Queues text laid out by layoutText() to be displayed on a line of the LCD
+ * in place of the text drawn on it before. Only the union of the old and new
+ * text is repainted: text drawn in the same place only redraws the characters
+ * that changed, and only the parts of the old text that the new text does not
+ * cover are cleared. Text queued for the line before and not drawn yet is
+ * replaced. Lines, including every row a line wraps over, must not overlap
+ * each other.
+ *
+ * line: the line of text, below TEXT_LINES.
+ * text: the text to display, an empty string clears the line.
+ * layout: the layout of the text.
+ */
+void drawLayout(uint8_t line, const char* text, const struct TextLayout* layout)
+{
+    if (layout->length > MAX_TEXT || startStep != START_DONE) {
+        return;
     }
-    for (uint8_t x = 145; x < 154; x++) {
-        ST7735_DrawPixel(&Lcd, x, 96, colour);
+
+    lines[line].wanted = *layout;
+    memcpy(lines[line].wantedText, text, layout->length);
+    queueRegion(line);
+}
+
+/* drawText()
+ * ----------
+ * Displays text on a line of the LCD in place of the text drawn on it before,
+ * see drawLayout().
+ *
+ * line: the line of text, below TEXT_LINES.
+ * text: the text to display, an empty string clears the line.
+ * x: the position in x-axis for where to display the text.
+ * y: the position in y-axis for where to display the text.
+ */
+void drawText(uint8_t line, char* text, uint8_t x, uint8_t y)
+{
+    struct TextLayout layout;
+    layoutText(&layout, strlen(text), x, y, 0);
+    drawLayout(line, text, &layout);
+}
+
+/* clearText()
+ * -----------
+ * Clears every line of text from the LCD.
+ */
+void clearText(void)
+{
+    for (uint8_t line = 0; line < TEXT_LINES; line++)
+        drawText(line, "", 0, 0);
+}
+
+/* drawConnected()
+ * ---------------
+ * Queues the 'connected' symbol to be drawn on the LCD.
+ *
+ * colour: the 16 bit colour of the symbol.
+ */
+void drawConnected(uint16_t colour)
+{
+    if (startStep != START_DONE)
+        return;
+
+    iconColour = colour;
+    queueRegion(REGION_ICON);
+}
+
+/* lcdService()
+ * ------------
+ * Takes the next step of drawing the region at the head of the render queue:
+ * a few rows of a fill or of old text to clear, one character or the
+ * 'connected' symbol. No step draws more than about RENDER_PIXELS pixels, so
+ * calling it once every pass of the main program never holds up the keys or
+ * HID reports for long.
+ */
+void lcdService(void)
+{
+    if (!queued)
+        return;
+
+    uint8_t region = queue[0];
+    uint8_t done = 1;
+    spiAcquire(SPI_LCD);
+    if (region == REGION_FILL) {
+        done = fillStep();
+    } else if (region == REGION_ICON) {
+        connectedSymbol(iconColour);
+    } else {
+        done = textStep(&lines[region]);
+    }
+    spiRelease();
+
+    if (done) {
+        queued--;
+        memmove(queue, queue + 1, queued);
     }
 }
 
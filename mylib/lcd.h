@@ -8,20 +8,50 @@
 
 #define F_CPU 11059200L
 #define MAX_BRIGHTNESS 255 // Max OCR1A value for timer for LCD back light.
+#define RENDER_PIXELS 640 // Max pixels drawn by each step of lcdService().
+#define LCD_RESET_DELAY 200 // Time in ms to hold each level of LCD reset.
+#define TEXT_LINES 2 // Lines of text drawText() keeps track of.
+#define TEXT_FIRST 0 // Line of text for names and messages.
+#define TEXT_SECOND 1 // Line of text below the first on the start screen.
+#define MAX_TEXT 30 // Max number of characters on a line of text.
 
 #include <stdint.h>
 
-// Initialises the LCD.
+// Where and how big a line of text is drawn.
+struct TextLayout {
+    uint8_t x; // Position of the first character.
+    uint8_t y;
+    uint8_t size; // Font size, X1, X2 or X3.
+    uint8_t length; // Number of characters.
+};
+
+// Initialises the LCD and starts its reset.
 void lcdInit(void);
 
-// Clears the LCD screen and displays the 'connected' icon if necessary.
+// Takes the next step of starting the LCD, returns 1 once it has started.
+uint8_t lcdReady(void);
+
+// Queues the screen to be cleared and the 'connected' icon if necessary.
 void fillScreen(uint16_t colour, uint8_t connected);
 
-// Displays text on the LCD.
-void drawText(char* text, uint8_t x, uint8_t y);
+// Works out the font size of text and where it starts.
+void layoutText(struct TextLayout* layout, uint8_t length, uint8_t x,
+    uint8_t y, uint8_t centre);
+
+// Displays text laid out by layoutText(), repainting only what changed.
+void drawLayout(uint8_t line, const char* text, const struct TextLayout* layout);
 
-// Draws the 'connected' symbol on the LCD.
+// Displays text on a line of the LCD, repainting only what changed.
+void drawText(uint8_t line, char* text, uint8_t x, uint8_t y);
+
+// Clears every line of text from the LCD.
+void clearText(void);
+
+// Queues the 'connected' symbol to be drawn on the LCD.
 void drawConnected(uint16_t colour);
 
+// Takes the next step of drawing what is waiting in the render queue.
+void lcdService(void);
+
 // Sets the brightness of the back light of the LCD.
 void setLcdBrightness(uint8_t brightnessLevel);
\ No newline at end of file
@@ -12,9 +12,7 @@
 #define F_CPU 11059200L
 
 #include "light_ws2812.h"
-#include <avr/interrupt.h>
-#include <avr/io.h>
-#include <util/delay.h>
+#include "hal.h"
  
 void inline ws2812_setleds(struct cRGB *ledarray, uint16_t leds)
 {
@@ -94,6 +92,17 @@ void ws2812_sendarray(uint8_t *data,uint16_t datlen)
 #define w_nop8  w_nop4 w_nop4
 #define w_nop16 w_nop8 w_nop8
 
+#ifdef HAL_HOST
+
+// The host simulator only needs the bytes and the time the bit stream takes.
+void inline ws2812_sendarray_mask(uint8_t *data,uint16_t datlen,uint8_t maskhi)
+{
+  (void)maskhi;
+  halHostLedWrite(data,datlen);
+}
+
+#else
+
 void inline ws2812_sendarray_mask(uint8_t *data,uint16_t datlen,uint8_t maskhi)
 {
   uint8_t curbyte,ctr,masklo;
@@ -170,3 +179,5 @@ w_nop16
   
   SREG=sreg_prev;
 }
+
+#endif
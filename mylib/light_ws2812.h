@@ -13,8 +13,7 @@
 #ifndef LIGHT_WS2812_H_
 #define LIGHT_WS2812_H_
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
 #include "ws2812_config.h"
 
 /*
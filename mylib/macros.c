@@ -7,20 +7,191 @@
 #include "macros.h"
 #include "16bitcolours.h"
 #include "addresses.h"
+#include "image.h"
 #include "keypad.h"
 #include "lcd.h"
 #include "memory.h"
 #include "rgbled.h"
+#include "spi.h"
+#include "timer.h"
 #include "usart.h"
-#include <avr/io.h>
+#include "hal.h"
 #include <stdlib.h>
 #include <string.h>
-#include <util/delay.h>
+
+// Timer 2 counts at fclk/8 in HID_DELAY us, rounded up.
+#define HID_DELAY_COUNT ((F_CPU / 8 * HID_DELAY + 999999) / 1000000)
 
 // Global variable array to store all macro data for all keys to make it
 // easier to access from macrolyze.c.
 struct MacroData macros[COLS][ROWS];
 
+// Execution state of every macro and a bitmap of the ones running, indexed
+// by KEY_INDEX().
+static struct MacroRun runs[COLS][ROWS];
+static uint16_t activeMacros;
+static uint16_t restartMacros; // Macros to run again after a release.
+static uint8_t releasePending; // Release report still has to be sent.
+
+// Reports sent to seeeduino and when the last one was sent, counted from the
+// SPI transfer complete interrupt, and the start of the burst of reports
+// being timed, to measure the rate macros are sent at.
+static volatile uint16_t reportsSent;
+static volatile uint32_t lastReportTime;
+static uint8_t burst; // Reports of a burst are being sent.
+static uint32_t burstStart;
+static uint16_t burstSent; // Reports sent before the burst.
+static uint16_t reportRate; // Reports per second of the last burst.
+
+// HID reports waiting for seeeduino to be idle. Reports are added by the main
+// program and sent in the background by the SPI transfer complete interrupt.
+static uint8_t reportQueue[REPORT_QUEUE][KEYS_PER_ACTION];
+static volatile uint8_t reportHead;
+static volatile uint8_t reportTail;
+static volatile uint8_t reportSending; // A report is being sent.
+
+// Compiled HID reports of the macros that have been run, each macro's
+// reports in one run starting at its firstReport. Each HID report is kept as
+// the one report byte that changes from the previous report and its new
+// value, or RELEASE_ALL_KEYS to empty the report.
+static uint8_t reportPool[REPORT_POOL][BYTES_PER_ACTION];
+static uint8_t poolUsed; // Reports in use from the start of the pool.
+
+// Fields received from GUI but not yet stored, kept as a record per field:
+// its letter and key number, then the length of the name and the name for
+// MACRO_NAME, the colour for MACRO_COLOUR, the gap and hold time for
+// MACRO_PACING, or the number of actions, the number of tokens and the
+// tokens for MACRO_ACTIONS. A whole key is kept as
+// its three fields and a later record of a field replaces an earlier one. A
+// whole key and its pacing take 6 bytes more here than in the image, so a
+// frame whose image fits always fits here.
+#define PENDING_SIZE (IMAGE_CAPACITY + 10 * 6)
+#define NO_RECORD 0xFFFF // Field has no pending record.
+static uint8_t pending[PENDING_SIZE];
+static uint16_t pendingLength; // Bytes of whole records.
+
+// Key or field being received from GUI by receiveMacroByte(), which is
+// written after the whole records in pending[].
+static uint8_t incomingField; // Letter that started the data.
+static uint8_t incomingKey;
+static uint16_t incomingIndex; // Index of the next byte.
+static uint16_t incomingLength; // Number of bytes once known.
+static uint8_t incomingActions; // Number of actions once known.
+static uint8_t incomingAction; // Key of the action being received.
+static uint8_t incomingRaw; // Tokens left to keep as they are received.
+static uint16_t incomingMerge; // First token actions can be merged into.
+static uint16_t incomingRecord; // Start of the record being written.
+static uint16_t incomingEnd; // End of the records written so far.
+
+// EEPROM address of the record of each key in the current image, indexed by
+// key number - 1, unless the macro data is still in its layout from before
+// the image was used. Each record is the number of actions, the length of
+// the name, the name, colour (3 bytes), gap and hold time, the number of
+// tokens and 2 bytes per token. Images of version 1 and 2 have no gap and
+// hold time, and version 1 has no number of tokens and a token for every
+// action, as do the actions of the old layout.
+static uint16_t keyAddress[10];
+static uint8_t oldLayout;
+static uint16_t loadedKeys; // Keys with their actions in the report pool.
+static uint16_t programKeys; // Loaded keys with instructions in their tokens.
+
+#define KEY_RECORD 8 // Bytes in the record of a key besides name and tokens.
+#define OLD_ACTIONS 20 // Room for the actions of a key in the old layout.
+
+// Where the fields of a key are in EEPROM.
+struct StoredKey {
+    uint8_t numActions;
+    uint16_t name; // Address of the name.
+    uint8_t nameLength; // Names are padded with 0x00 in the old layout.
+    uint16_t colour; // Address of the colour.
+    uint16_t pacing; // Address of the gap and hold time, 0 if not stored.
+    uint16_t tokens; // Address of the first token.
+    uint8_t numTokens;
+};
+
+// Layout of the name of every key, indexed by key number - 1, worked out when
+// the key is loaded so showing a name only reads its characters. The names
+// laid out and the names shown with their layout are counted.
+static struct TextLayout nameLayouts[10];
+static uint16_t namesLaidOut;
+static uint16_t namesShown;
+
+// Reads the actions of a key one at a time from its tokens.
+struct ActionReader {
+    uint16_t address; // Address of the next token.
+    uint8_t key; // Key of the current token.
+    uint8_t control; // Control byte of the current token.
+    uint8_t left; // Actions left in the current token.
+    uint8_t raw; // Tokens left to pass on as they are after an instruction.
+};
+
+// Macros with more than STREAM_ACTIONS actions or with instructions are not
+// compiled but run from their tokens in EEPROM, which are read ahead into a
+// small buffer whenever the EEPROM is free. The macro then never waits for a
+// write being programmed, and holds only a few tokens in RAM however long it
+// is. Instructions are run as the tokens are reached, an instruction that
+// types or presses keys by queueing the actions it stands for, so a macro
+// that waits for a delay only stops itself and not the main loop.
+struct MacroStream {
+    struct MacroRun* run; // Run of the macro, or NULL if the stream is free.
+    struct ActionReader reader; // Current token and next token to read.
+    uint8_t tokensLeft; // Tokens not yet read ahead.
+    uint8_t tokens[PREFETCH][BYTES_PER_ACTION]; // Tokens read ahead.
+    uint8_t first; // Index of the oldest token read ahead.
+    uint8_t count; // Number of tokens read ahead.
+
+    uint8_t queue[ACTION_QUEUE][BYTES_PER_ACTION]; // Actions of instruction.
+    uint8_t queued; // Number of actions in the queue.
+    uint8_t next; // Index of the next action in the queue.
+    uint8_t instruction; // OP_STRING or OP_CHORD reading its operands.
+    uint8_t operands; // Characters or keys left to read.
+    uint8_t shift; // Whether OP_STRING is holding shift.
+    uint8_t chord[CHORD_KEYS]; // Keys of OP_CHORD.
+    uint8_t chordKeys;
+    uint8_t loops; // Runs left of the tokens repeated by OP_REPEAT.
+    uint8_t loopTokens; // Tokens not read ahead at the start of the loop.
+    uint16_t loopAddress; // Address of the first token of the loop.
+    uint32_t delayStart; // Time OP_DELAY started.
+    uint16_t delay; // Number of ms left to wait from delayStart.
+};
+static struct MacroStream streams[STREAMS];
+
+// Values returned by streamReport().
+#define STREAM_CHANGED 0 // The HID report of the macro was changed.
+#define STREAM_WAITING 1 // Next token has not been read ahead or is delayed.
+#define STREAM_ENDED 2 // The macro has no actions left.
+
+// Values returned by compileActions().
+#define COMPILE_FULL 0 // The reports do not fit in the report pool.
+#define COMPILE_DONE 1 // The reports were added to the report pool.
+#define COMPILE_PROGRAM 2 // The macro has instructions so is not compiled.
+
+// A queued action applied in the same report as the action after it.
+#define ACTION_GROUP TOKEN_TAP
+
+#define LEFT_SHIFT (1 << 1) // Modifier bit of left shift.
+#define USAGE_ENTER 0x28 // HID usage typed for '\n'.
+#define USAGE_LEFT_CONTROL 0xE0 // First HID usage of a modifier key.
+#define USAGE_RIGHT_GUI 0xE7 // Last HID usage of a modifier key.
+#define ASCII_SHIFT (1 << 7) // Character is typed with shift held.
+
+// HID usage of every printable ASCII character from ' ' to '~' on a US
+// layout, with ASCII_SHIFT (0x80) set if shift is held to type it.
+static const uint8_t asciiUsages[] PROGMEM = {
+    0x2C, 0x9E, 0xB4, 0xA0, 0xA1, 0xA2, 0xA4, 0x34, // space ! " # $ % & '
+    0xA6, 0xA7, 0xA5, 0xAE, 0x36, 0x2D, 0x37, 0x38, // ( ) * + , - . /
+    0x27, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, // 0 1 2 3 4 5 6 7
+    0x25, 0x26, 0xB3, 0x33, 0xB6, 0x2E, 0xB7, 0xB8, // 8 9 : ; < = > ?
+    0x9F, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, // @ A B C D E F G
+    0x8B, 0x8C, 0x8D, 0x8E, 0x8F, 0x90, 0x91, 0x92, // H I J K L M N O
+    0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, // P Q R S T U V W
+    0x9B, 0x9C, 0x9D, 0x2F, 0x31, 0x30, 0xA3, 0xAD, // X Y Z [ backslash ] ^ _
+    0x35, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, // ` a b c d e f g
+    0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, // h i j k l m n o
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, // p q r s t u v w
+    0x1B, 0x1C, 0x1D, 0xAF, 0xB1, 0xB0, 0xB5, // x y z { | } ~
+};
+
 /* macrosInit()
  * ------------
  * Initialises SPI to send HID reports to seeediuno.
@@ -33,13 +204,21 @@ void macrosInit(void)
     // Set SS pin for seeeduino to output.
     DDRC |= (1 << 1);
 
-    // SPI is already setup by St7735 library, however clock speed must be
-    // divided by 16 to avoid damaging seeeduino.
-    SPCR |= (1 << SPR0);
+    // SPI is already setup by St7735 library, the clock speed for seeeduino is
+    // set by spi.c whenever it is given the bus.
 
     // Use Port C1 for SS and set to 1
     PORTC |= (1 << 1);
 
+    // Interrupt on changes of the IDLE pin (PCINT21) to send queued reports.
+    PCMSK2 |= (1 << PCINT21);
+    PCICR |= (1 << PCIE2);
+
+    // Timer 2 times how long SS is held after a report, in CTC mode and
+    // stopped until a report is sent.
+    TCCR2A = (1 << WGM21);
+    OCR2A = HID_DELAY_COUNT;
+
     // Initialise colour for brightness auxiliary key.
     setMacroColour(2, 2, 255, 255, 255);
     setMacroNumActions(2, 2, 1);
@@ -48,38 +227,6 @@ void macrosInit(void)
     setMacroColour(3, 2, 255, 255, 255);
 }
 
-/* actionTransmit()
- * ----------------
- * Sends a byte through SPI.
- *
- * byte: the byte to send through SPI.
- */
-void actionTransmit(uint8_t byte)
-{
-    // Start transmission
-    SPDR = byte;
-
-    // Wait until transmission completes
-    while (!(SPSR & (1 << SPIF))) { }
-}
-
-/* setMacroName()
- * --------------
- * Sets the name of specified macro in macroData.
- *
- * col: the column of macro key to set.
- * row: the row of macro key to set.
- * name: a pointer to an array with the macro name to set.
- */
-void setMacroName(uint8_t col, uint8_t row, char* name)
-{
-    uint8_t nameLength = strlen(name);
-
-    for (uint8_t character = 0; character < nameLength; character++)
-        macros[col][row].name[character] = name[character];
-    macros[col][row].name[nameLength] = 0x00;
-}
-
 /* getMacroNumActions()
  * --------------------
  * Gets the number of actions in the specified macro key.
@@ -126,26 +273,6 @@ void setMacroNumActions(uint8_t col, uint8_t row, uint8_t numActions)
     macros[col][row].numOfActions = numActions;
 }
 
-/* setMacroAction()
- * --------------
- * Sets the actions for specified macro in macroData.
- *
- * col: the column of macro key to set.
- * row: the row of macro key to set.
- * report: an array with all the actions of the macro.
- */
-void setMacroAction(uint8_t col, uint8_t row,
-    uint8_t report[MAX_ACTIONS][BYTES_PER_ACTION])
-{
-    uint8_t numActions = macros[col][row].numOfActions;
-
-    // Iterate through all bytes in report and store to macroData.
-    for (uint8_t action = 0; action < numActions; action++) {
-        for (uint8_t key = 0; key < BYTES_PER_ACTION; key++)
-            macros[col][row].actionsReport[action][key] = report[action][key];
-    }
-}
-
 /* modifyReport()
  * --------------
  * Modifies the HID report based on data for the current action.
@@ -184,80 +311,1047 @@ void modifyReport(uint8_t* hidReport, uint8_t keyPressed, uint8_t keyData)
     }
 }
 
-/* sendReport()
+/* findKey()
+ * ---------
+ * Finds where the fields of a key are stored in EEPROM.
+ *
+ * key: the key number.
+ * stored: the struct to fill in with the addresses of the fields.
+ */
+static void findKey(uint8_t key, struct StoredKey* stored)
+{
+    if (oldLayout) {
+        stored->numActions = eepromRead(NUM_ACTIONS_ADDRESS + (key - 1));
+        stored->name = NAME_ADDRESS + ((key - 1) * 30);
+        stored->nameLength = 30;
+        stored->colour = COLOUR_ADDRESS + ((key - 1) * 3);
+        stored->pacing = 0;
+        stored->tokens = ACTIONS_ADDRESS + ((key - 1) * 40);
+
+        // Erased EEPROM reads 0xFF, so treat an invalid count as empty and
+        // a key that was never stored as having no name.
+        if (stored->numActions == 0xFF || eepromRead(stored->name) == 0xFF)
+            stored->nameLength = 0;
+        if (stored->numActions > OLD_ACTIONS)
+            stored->numActions = 0;
+        stored->numTokens = stored->numActions;
+        return;
+    }
+
+    // The image was checked as a whole by its CRC, so it is trusted.
+    uint16_t address = keyAddress[key - 1];
+    stored->numActions = eepromRead(address);
+    stored->nameLength = eepromRead(address + 1);
+    stored->name = address + 2;
+    stored->colour = stored->name + stored->nameLength;
+    stored->pacing = 0;
+    stored->tokens = stored->colour + 3;
+    if (imageVersion() > 2) {
+        stored->pacing = stored->tokens;
+        stored->tokens += 2;
+    }
+    stored->numTokens = stored->numActions;
+    if (imageVersion() > 1)
+        stored->numTokens = eepromRead(stored->tokens++);
+}
+
+/* readName()
+ * ----------
+ * Reads the name of a key from EEPROM, up to its first 0x00 or erased 0xFF.
+ *
+ * key: the key number, keys after 10 have no name.
+ * name: an array of MAX_CHARACTERS to read the name into.
+ *
+ * Returns: the length of the name.
+ */
+static uint8_t readName(uint8_t key, char* name)
+{
+    uint8_t length = 0;
+    if (key <= 10) {
+        struct StoredKey stored;
+        findKey(key, &stored);
+        for (; length < stored.nameLength; length++) {
+            name[length] = eepromRead(stored.name + length);
+            if (!name[length] || name[length] == (char)0xFF)
+                break;
+        }
+    }
+    name[length] = 0x00;
+    return length;
+}
+
+/* layoutName()
  * ------------
- * Sends a HID report of 8 bytes through SPI.
+ * Reads the name of a key from EEPROM and works out where it is drawn on the
+ * LCD, centred on NAME_X.
  *
- * hidReport: a pointer to an array of 8 bytes containing the HID report.
+ * key: the key number, from 1 to 10.
+ * name: an array of MAX_CHARACTERS to read the name into.
  */
-void sendReport(uint8_t* hidReport)
+static void layoutName(uint8_t key, char* name)
 {
-    // Wait until IDLE pin is high
-    while (!(PIND & (1 << 5))) { }
+    uint8_t length = readName(key, name);
+    layoutText(&nameLayouts[key - 1], length, NAME_X, NAME_Y, 1);
+    namesLaidOut++;
+}
 
-    // Set SS high to start transmission of 1 action.
-    PORTC &= ~(1 << 1);
-    for (uint8_t key = 0; key < KEYS_PER_ACTION; key++) {
-        actionTransmit(hidReport[key]);
+/* operandTokens()
+ * ---------------
+ * Gets the number of tokens of characters or keys after an instruction.
+ *
+ * key: the operand of the instruction.
+ * control: the control byte of the instruction.
+ *
+ * Returns: the number of tokens.
+ */
+static uint8_t operandTokens(uint8_t key, uint8_t control)
+{
+    uint8_t instruction = control & TOKEN_COUNT;
+    if (instruction == OP_STRING || instruction == OP_CHORD)
+        return (key + 1) / 2;
+    return 0;
+}
+
+/* startToken()
+ * ------------
+ * Starts reading the actions of a token.
+ *
+ * reader: the reader of the key's actions.
+ * key: the key of the token.
+ * control: the control byte of the token.
+ */
+static void startToken(struct ActionReader* reader, uint8_t key,
+    uint8_t control)
+{
+    reader->key = key;
+    reader->control = control;
+    reader->left = (control & TOKEN_COUNT) + 1;
+    if (control & TOKEN_TAP)
+        reader->left *= 2;
+}
+
+/* nextAction()
+ * ------------
+ * Gets the next action of the current token, which has actions left.
+ *
+ * reader: the reader of the key's actions.
+ * action: an array of 2 bytes to put the key and data of the action into.
+ */
+static void nextAction(struct ActionReader* reader, uint8_t* action)
+{
+    reader->left--;
+
+    // A tap is a press while an odd number of actions are left, then a
+    // release.
+    action[0] = reader->key;
+    action[1] = reader->control & (MODIFIER | PRESSED);
+    if (reader->control & TOKEN_TAP)
+        action[1] = (reader->control & MODIFIER) | (reader->left % 2 ? PRESSED : 0);
+}
+
+/* readAction()
+ * ------------
+ * Reads the next action of a key from its tokens in EEPROM. An instruction
+ * and the tokens of its characters or keys are each read as one action, the
+ * same as they were received.
+ *
+ * reader: the reader of the key's actions, started with the address of the
+ *     first token and no actions left.
+ * action: an array of 2 bytes to read the key and data of the action into.
+ */
+static void readAction(struct ActionReader* reader, uint8_t* action)
+{
+    if (!reader->left) {
+        uint8_t key = eepromRead(reader->address);
+        uint8_t control = eepromRead(reader->address + 1);
+        reader->address += BYTES_PER_ACTION;
+        if (reader->raw || (control & TOKEN_INSTRUCTION) == TOKEN_INSTRUCTION) {
+            reader->raw = reader->raw ? reader->raw - 1
+                                      : operandTokens(key, control);
+            action[0] = key;
+            action[1] = control;
+            return;
+        }
+        startToken(reader, key, control);
     }
+    nextAction(reader, action);
+}
+
+/* compileActions()
+ * ----------------
+ * Compiles the actions of a macro into the sequence of HID reports they
+ * produce, so running the macro needs no decoding. The reports are added to
+ * the end of the report pool. Actions that do not change the report are left
+ * out.
+ *
+ * macro: the macro to compile.
+ * tokens: the EEPROM address of the first token of the macro.
+ *
+ * Returns: COMPILE_DONE if the reports fit in the report pool, COMPILE_FULL
+ *     if they do not or COMPILE_PROGRAM if the macro has instructions.
+ */
+static uint8_t compileActions(struct MacroData* macro, uint16_t tokens)
+{
+    uint8_t hidReport[KEYS_PER_ACTION] = { EMPTY_KEY };
+    struct ActionReader reader = { .address = tokens };
+    uint8_t numReports = 0;
+
+    for (uint8_t action = 0; action < macro->numOfActions; action++) {
+        uint8_t previous[KEYS_PER_ACTION];
+        memcpy(previous, hidReport, KEYS_PER_ACTION);
+
+        // Apply the action the same way the report was built when sending.
+        uint8_t next[BYTES_PER_ACTION];
+        readAction(&reader, next);
+        if ((next[1] & TOKEN_INSTRUCTION) == TOKEN_INSTRUCTION)
+            return COMPILE_PROGRAM;
+        uint8_t keyPressed = next[0];
+        if (keyPressed == RELEASE_ALL_KEYS)
+            memset(hidReport, EMPTY_KEY, KEYS_PER_ACTION);
+        modifyReport(hidReport, keyPressed, next[1]);
+
+        // Find which bytes of the report changed.
+        uint8_t changed = 0;
+        uint8_t slot = 0;
+        for (uint8_t i = 0; i < KEYS_PER_ACTION; i++) {
+            if (hidReport[i] != previous[i]) {
+                changed++;
+                slot = i;
+            }
+        }
+        if (!changed)
+            continue;
+        if (poolUsed + numReports >= REPORT_POOL)
+            return COMPILE_FULL;
+
+        // Only releasing all keys can change more than one byte.
+        uint8_t* report = reportPool[poolUsed + numReports];
+        if (changed > 1) {
+            report[REPORT_SLOT] = RELEASE_ALL_KEYS;
+            report[REPORT_VALUE] = EMPTY_KEY;
+        } else {
+            report[REPORT_SLOT] = slot;
+            report[REPORT_VALUE] = hidReport[slot];
+        }
+        numReports++;
+    }
+    macro->firstReport = poolUsed;
+    macro->numOfReports = numReports;
+    poolUsed += numReports;
+    return COMPILE_DONE;
+}
+
+/* findStream()
+ * ------------
+ * Finds the stream used by a running macro.
+ *
+ * run: the run of the macro, or NULL to find a free stream.
+ *
+ * Returns: the stream, or NULL if there is none.
+ */
+static struct MacroStream* findStream(struct MacroRun* run)
+{
+    for (uint8_t i = 0; i < STREAMS; i++) {
+        if (streams[i].run == run)
+            return &streams[i];
+    }
+    return NULL;
+}
+
+/* fillStream()
+ * ------------
+ * Reads tokens of a macro run from EEPROM ahead into its buffer, for as long
+ * as the EEPROM can be read without waiting.
+ *
+ * stream: the stream of the macro.
+ */
+static void fillStream(struct MacroStream* stream)
+{
+    while (stream->tokensLeft && stream->count < PREFETCH) {
+        uint8_t* token = stream->tokens[(stream->first + stream->count) % PREFETCH];
+        uint16_t address = stream->reader.address;
+        if (!eepromTryRead(address, &token[0])
+            || !eepromTryRead(address + 1, &token[1]))
+            return;
+        stream->reader.address += BYTES_PER_ACTION;
+        stream->tokensLeft--;
+        stream->count++;
+    }
+}
+
+/* stopStream()
+ * ------------
+ * Drops the tokens and instructions of a macro run from EEPROM, so it has no
+ * actions left.
+ *
+ * stream: the stream of the macro.
+ */
+static void stopStream(struct MacroStream* stream)
+{
+    struct MacroRun* run = stream->run;
+    memset(stream, 0, sizeof(struct MacroStream));
+    stream->run = run;
+}
+
+/* startStream()
+ * -------------
+ * Starts running a macro from its tokens in EEPROM.
+ *
+ * stream: the stream to use.
+ * run: the run of the macro.
+ * key: the key number of the macro.
+ */
+static void startStream(struct MacroStream* stream, struct MacroRun* run,
+    uint8_t key)
+{
+    struct StoredKey stored;
+    findKey(key, &stored);
+    stream->run = run;
+    stopStream(stream);
+    stream->reader.address = stored.tokens;
+    stream->tokensLeft = stored.numTokens;
+    fillStream(stream);
+}
+
+/* moveStreams()
+ * -------------
+ * Points every stream at the same token in the new image once it has been
+ * committed, as the bank the tokens were read from is written next time.
+ */
+static void moveStreams(void)
+{
+    for (uint8_t i = 0; i < STREAMS; i++) {
+        struct MacroStream* stream = &streams[i];
+        if (!stream->run)
+            continue;
+
+        uint8_t index = stream->run - &runs[0][0];
+        struct StoredKey stored;
+        findKey(KEY_NUMBER(index / ROWS, index % ROWS), &stored);
+        stream->reader.address = stored.tokens
+            + (stored.numTokens - stream->tokensLeft) * BYTES_PER_ACTION;
+        stream->loopAddress = stored.tokens
+            + (stored.numTokens - stream->loopTokens) * BYTES_PER_ACTION;
+    }
+}
+
+/* queueAction()
+ * -------------
+ * Adds an action to the actions of the instruction being run.
+ *
+ * stream: the stream of the macro.
+ * key: the key of the action.
+ * data: the data byte of the action.
+ */
+static void queueAction(struct MacroStream* stream, uint8_t key, uint8_t data)
+{
+    uint8_t* action = stream->queue[stream->queued++];
+    action[0] = key;
+    action[1] = data;
+}
+
+/* typeCharacter()
+ * ---------------
+ * Queues the actions that type an ASCII character for OP_STRING. Shift is
+ * only pressed or released when the character needs it to change, and
+ * characters with no HID usage are left out.
+ *
+ * stream: the stream of the macro.
+ * character: the character to type.
+ */
+static void typeCharacter(struct MacroStream* stream, uint8_t character)
+{
+    uint8_t usage = 0;
+    if (character == '\n')
+        usage = USAGE_ENTER;
+    else if (character >= ' ' && character <= '~')
+        usage = pgm_read_byte(&asciiUsages[character - ' ']);
+    if (!usage)
+        return;
+
+    uint8_t shift = usage & ASCII_SHIFT;
+    if (shift != stream->shift) {
+        queueAction(stream, LEFT_SHIFT, MODIFIER | (shift ? PRESSED : 0));
+        stream->shift = shift;
+    }
+    usage &= ~ASCII_SHIFT;
+    queueAction(stream, usage, PRESSED);
+    queueAction(stream, usage, 0);
+}
+
+/* queueChord()
+ * ------------
+ * Queues the actions of OP_CHORD, which press all its keys in one report and
+ * then release them in the next.
+ *
+ * stream: the stream of the macro.
+ */
+static void queueChord(struct MacroStream* stream)
+{
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        for (uint8_t i = 0; i < stream->chordKeys; i++) {
+            uint8_t key = stream->chord[i];
+            uint8_t data = pass ? 0 : PRESSED;
+            if (key >= USAGE_LEFT_CONTROL && key <= USAGE_RIGHT_GUI) {
+                key = 1 << (key - USAGE_LEFT_CONTROL);
+                data |= MODIFIER;
+            }
+            if (i + 1 < stream->chordKeys)
+                data |= ACTION_GROUP;
+            queueAction(stream, key, data);
+        }
+    }
+}
+
+/* runToken()
+ * ----------
+ * Runs the next token of a macro run from EEPROM. Actions are started in the
+ * reader, an instruction that types or presses keys queues its actions once
+ * its characters or keys have been read, and the other instructions change
+ * where or when the next token is run.
+ *
+ * stream: the stream of the macro.
+ * key: the key of the token.
+ * control: the control byte of the token.
+ */
+static void runToken(struct MacroStream* stream, uint8_t key, uint8_t control)
+{
+    stream->queued = 0;
+    stream->next = 0;
+
+    // Characters or keys of the instruction, two per token.
+    if (stream->operands) {
+        for (uint8_t i = 0; i < 2 && stream->operands; i++) {
+            uint8_t operand = i ? control : key;
+            stream->operands--;
+            if (stream->instruction == OP_STRING)
+                typeCharacter(stream, operand);
+            else if (stream->chordKeys < CHORD_KEYS)
+                stream->chord[stream->chordKeys++] = operand;
+        }
+        if (stream->operands)
+            return;
+
+        if (stream->instruction == OP_CHORD) {
+            queueChord(stream);
+        } else if (stream->shift) {
+            queueAction(stream, LEFT_SHIFT, MODIFIER);
+            stream->shift = 0;
+        }
+        return;
+    }
+
+    if ((control & TOKEN_INSTRUCTION) != TOKEN_INSTRUCTION) {
+        startToken(&stream->reader, key, control);
+        return;
+    }
+
+    switch (control & TOKEN_COUNT) {
+    case OP_DELAY:
+        stream->delayStart = getCurrentTime();
+        stream->delay = key * DELAY_UNIT;
+        break;
+
+    case OP_STRING:
+    case OP_CHORD:
+        stream->instruction = control & TOKEN_COUNT;
+        stream->operands = key;
+        stream->chordKeys = 0;
+        break;
+
+    case OP_REPEAT:
+        // The loop starts at the token after this one, which may have been
+        // read ahead already.
+        stream->loops = key;
+        stream->loopTokens = stream->tokensLeft + stream->count;
+        stream->loopAddress = stream->reader.address
+            - stream->count * BYTES_PER_ACTION;
+        break;
+
+    case OP_END:
+        if (stream->loops && --stream->loops) {
+            stream->reader.address = stream->loopAddress;
+            stream->tokensLeft = stream->loopTokens;
+            stream->count = 0;
+        }
+        break;
+    }
+}
+
+/* streamDone()
+ * ------------
+ * Returns: whether a macro run from EEPROM has no actions or tokens left.
+ */
+static uint8_t streamDone(struct MacroStream* stream)
+{
+    return !stream->reader.left && stream->next >= stream->queued
+        && !stream->count && !stream->tokensLeft;
+}
+
+/* streamReport()
+ * --------------
+ * Applies the actions of a macro run from EEPROM to its HID report until one
+ * changes it, the same way the actions are compiled. Instructions are run as
+ * they are reached, and a delay leaves the report unchanged until it is
+ * over, so the macro is resumed on a later call instead of waiting here.
+ *
+ * stream: the stream of the macro.
+ * hidReport: a pointer to the HID report of 8 bytes of the macro.
+ *
+ * Returns: STREAM_CHANGED if the report was changed, STREAM_WAITING if the
+ *     next token has not been read yet or is delayed or STREAM_ENDED if no
+ *     actions are left.
+ */
+static uint8_t streamReport(struct MacroStream* stream, uint8_t* hidReport)
+{
+    uint8_t previous[KEYS_PER_ACTION];
+    memcpy(previous, hidReport, KEYS_PER_ACTION);
+    for (;;) {
+        uint8_t action[BYTES_PER_ACTION];
+        if (stream->next < stream->queued) {
+            memcpy(action, stream->queue[stream->next++], BYTES_PER_ACTION);
+        } else if (stream->reader.left) {
+            nextAction(&stream->reader, action);
+        } else {
+            if (stream->delay) {
+                if (getCurrentTime() - stream->delayStart < stream->delay)
+                    return STREAM_WAITING;
+                stream->delay = 0;
+            }
+            if (!stream->count)
+                fillStream(stream);
+            if (!stream->count)
+                return stream->tokensLeft ? STREAM_WAITING : STREAM_ENDED;
+            uint8_t* token = stream->tokens[stream->first];
+            stream->first = (stream->first + 1) % PREFETCH;
+            stream->count--;
+            runToken(stream, token[0], token[1]);
+            continue;
+        }
+
+        if (action[0] == RELEASE_ALL_KEYS)
+            memset(hidReport, EMPTY_KEY, KEYS_PER_ACTION);
+        modifyReport(hidReport, action[0], action[1]);
+        if (!(action[1] & ACTION_GROUP)
+            && memcmp(previous, hidReport, KEYS_PER_ACTION))
+            return STREAM_CHANGED;
+    }
+}
+
+/* loadMacroSummary()
+ * ------------------
+ * Retrieves the colour and number of actions of one key from EEPROM, which
+ * the LEDs need from start up. The actions are left to loadMacro().
+ *
+ * key: the key number to retrieve.
+ *
+ * Returns: the number of bytes in the record of the key in the image.
+ */
+static uint16_t loadMacroSummary(uint8_t key)
+{
+    uint8_t* keyIndex;
+    uint8_t matrixLocation[2];
+    keyIndex = keyLocation(matrixLocation, key); // Get matrix location of key.
+    uint8_t col = keyIndex[0];
+    uint8_t row = keyIndex[1];
+
+    struct StoredKey stored;
+    findKey(key, &stored);
+    setMacroColour(col, row, eepromRead(stored.colour),
+        eepromRead(stored.colour + 1), eepromRead(stored.colour + 2));
+    setMacroNumActions(col, row, stored.numActions);
+    macros[col][row].gap = stored.pacing ? eepromRead(stored.pacing) : 0;
+    macros[col][row].hold = stored.pacing ? eepromRead(stored.pacing + 1) : 0;
+
+    char name[MAX_CHARACTERS];
+    layoutName(key, name);
+    return stored.tokens + stored.numTokens * BYTES_PER_ACTION
+        - keyAddress[key - 1];
+}
+
+/* unloadMacro()
+ * -------------
+ * Drops the compiled reports or the stream of one key, which stops the macro
+ * if it is running.
+ *
+ * key: the key number.
+ */
+static void unloadMacro(uint8_t key)
+{
+    uint8_t matrixLocation[2];
+    uint8_t* keyIndex = keyLocation(matrixLocation, key);
+    macros[keyIndex[0]][keyIndex[1]].numOfReports = 0;
+    loadedKeys &= ~(1 << (key - 1));
+    programKeys &= ~(1 << (key - 1));
+
+    struct MacroStream* stream = findStream(&runs[keyIndex[0]][keyIndex[1]]);
+    if (stream)
+        stopStream(stream);
+}
+
+/* compactReports()
+ * ----------------
+ * Makes room in the report pool by unloading every macro that is not running
+ * and moving the reports of the running macros to the start of the pool.
+ * They are moved in the order they are in the pool, so none is overwritten
+ * before it is moved.
+ */
+static void compactReports(void)
+{
+    uint16_t running = activeMacros | restartMacros;
+    uint16_t moved = 0;
+    poolUsed = 0;
+    while (running & ~moved) {
+        // Find the running macro with the first reports not yet moved.
+        uint8_t next = 0;
+        for (uint8_t key = 0; key < KEYS; key++) {
+            if (!((running & ~moved) & (1 << key)))
+                continue;
+            if (!((running & ~moved) & (1 << next))
+                || macros[key / ROWS][key % ROWS].firstReport
+                    < macros[next / ROWS][next % ROWS].firstReport)
+                next = key;
+        }
+
+        struct MacroData* macro = &macros[next / ROWS][next % ROWS];
+        memmove(reportPool[poolUsed], reportPool[macro->firstReport],
+            macro->numOfReports * BYTES_PER_ACTION);
+        macro->firstReport = poolUsed;
+        poolUsed += macro->numOfReports;
+        moved |= (1 << next);
+    }
+
+    uint8_t matrixLocation[2];
+    for (uint8_t key = 1; key <= 10; key++) {
+        uint8_t* keyIndex = keyLocation(matrixLocation, key);
+        if (!(moved & (1 << KEY_INDEX(keyIndex[0], keyIndex[1]))))
+            unloadMacro(key);
+    }
+}
+
+/* loadMacro()
+ * -----------
+ * Compiles the actions of one key into the report pool the first time the
+ * macro is run, instead of every key at start up. Macros that are not
+ * running are unloaded if the pool is full. A macro whose reports do not fit
+ * even then is left with no reports, and a macro with instructions is marked
+ * to be run from EEPROM.
+ *
+ * key: the key number to retrieve.
+ */
+static void loadMacro(uint8_t key)
+{
+    uint16_t keyBit = 1 << (key - 1);
+    if (key > 10 || (loadedKeys & keyBit))
+        return;
+
+    uint8_t* keyIndex;
+    uint8_t matrixLocation[2];
+    keyIndex = keyLocation(matrixLocation, key); // Get matrix location of key.
+    struct MacroData* macro = &macros[keyIndex[0]][keyIndex[1]];
+
+    struct StoredKey stored;
+    findKey(key, &stored);
+    uint8_t compiled = compileActions(macro, stored.tokens);
+    if (compiled == COMPILE_FULL) {
+        compactReports();
+        compiled = compileActions(macro, stored.tokens);
+    }
+    if (compiled == COMPILE_FULL)
+        return;
+    if (compiled == COMPILE_PROGRAM)
+        programKeys |= keyBit;
+    loadedKeys |= keyBit;
+}
+
+/* isStreamed()
+ * ------------
+ * Checks whether a macro is run from EEPROM instead of being compiled.
+ *
+ * col: the column of macro key.
+ * row: the row of macro key.
+ *
+ * Returns: 1 if the macro is long or has instructions, otherwise 0.
+ */
+static uint8_t isStreamed(uint8_t col, uint8_t row)
+{
+    return macros[col][row].numOfActions > STREAM_ACTIONS
+        || (programKeys & (1 << (KEY_NUMBER(col, row) - 1)));
+}
+
+/* queueReport()
+ * -------------
+ * Adds a HID report to the queue of reports to send to seeeduino.
+ *
+ * hidReport: a pointer to an array of 8 bytes containing the HID report.
+ *
+ * Returns: 1 if the report was queued or 0 if the queue is full.
+ */
+static uint8_t queueReport(uint8_t* hidReport)
+{
+    uint8_t next = (reportHead + 1) % REPORT_QUEUE;
+    if (next == reportTail)
+        return 0;
 
-    // Wait 20us
-    _delay_us(HID_DELAY);
+    for (uint8_t i = 0; i < KEYS_PER_ACTION; i++)
+        reportQueue[reportHead][i] = hidReport[i];
+    reportHead = next;
+    return 1;
+}
 
-    // Set SS low to end transmission of 1 action.
+/* endReport()
+ * -----------
+ * Starts timer 2 once the last byte of a HID report has been sent, so SS is
+ * held low for HID_DELAY us without waiting in the SPI transfer complete
+ * interrupt it is called from. The bus is kept until the timer ends the
+ * transmission.
+ */
+static void endReport(void)
+{
+    TCNT2 = 0;
+    TIFR2 = (1 << OCF2A);
+    TIMSK2 |= (1 << OCIE2A);
+    TCCR2B = (1 << CS21); // Count at fclk/8.
+}
+
+// End the transmission of a HID report once SS has been held for HID_DELAY us
+// and release the SPI bus.
+ISR(TIMER2_COMPA_vect)
+{
+    TCCR2B = 0;
+    TIMSK2 &= ~(1 << OCIE2A);
+
+    // Set SS high to end transmission of 1 action.
     PORTC |= (1 << 1);
+
+    reportTail = (reportTail + 1) % REPORT_QUEUE;
+    reportSending = 0;
+    reportsSent++;
+    lastReportTime = getCurrentTime();
+    spiRelease();
+}
+
+/* startReport()
+ * -------------
+ * Starts sending the oldest queued HID report once seeeduino has the SPI bus.
+ */
+static void startReport(void)
+{
+    // Set SS low to start transmission of 1 action.
+    PORTC &= ~(1 << 1);
+    spiTransmit(reportQueue[reportTail], KEYS_PER_ACTION, endReport);
+}
+
+/* sendQueuedReport()
+ * ------------------
+ * Starts sending the oldest queued HID report if seeeduino is idle. Called
+ * from the IDLE pin change interrupt and from the main loop, which picks up
+ * reports queued while seeeduino was already idle.
+ */
+static void sendQueuedReport(void)
+{
+    // Check with interrupts disabled so the interrupt and the main program
+    // cannot both send.
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t send = !reportSending && reportHead != reportTail
+        && (PIND & (1 << 5));
+    if (send)
+        reportSending = 1;
+    SREG = sreg;
+
+    if (send)
+        spiRequest(SPI_HID, startReport);
+}
+
+/* startMacro()
+ * ------------
+ * Marks the macro as running from its first action with an empty HID report.
+ * A macro run from EEPROM uses the stream it already has or a free one.
+ *
+ * col: the column of macro key to start.
+ * row: the row of macro key to start.
+ */
+static void startMacro(uint8_t col, uint8_t row)
+{
+    struct MacroRun* run = &runs[col][row];
+    run->action = 0;
+    run->again = 0;
+    for (uint8_t i = 0; i < KEYS_PER_ACTION; i++)
+        run->hidReport[i] = EMPTY_KEY;
+    run->due = getCurrentTime();
+    activeMacros |= (1 << KEY_INDEX(col, row));
+
+    if (isStreamed(col, row)) {
+        struct MacroStream* stream = findStream(run);
+        if (!stream)
+            stream = findStream(NULL);
+        startStream(stream, run, KEY_NUMBER(col, row));
+    }
 }
 
 /* executeMacro()
  * --------------
- * Sends all actions of macro as HID reports to seeeduino.
+ * Starts sending all actions of macro as HID reports to seeeduino. The
+ * actions are sent by runMacros() so several macros can run at once. If the
+ * macro is already running it is run again once it finishes.
  *
  * col: the column of macro key to set.
  * row: the row of macro key to set.
  */
 void executeMacro(uint8_t col, uint8_t row)
 {
-    uint8_t numOfActions = macros[col][row].numOfActions;
-    if (!numOfActions)
+    // Long macros and macros with instructions need a stream, the others
+    // are compiled.
+    struct MacroRun* run = &runs[col][row];
+    if (macros[col][row].numOfActions <= STREAM_ACTIONS)
+        loadMacro(KEY_NUMBER(col, row));
+    if (isStreamed(col, row)) {
+        if (!findStream(run) && !findStream(NULL))
+            return;
+    } else if (!macros[col][row].numOfReports) {
         return;
+    }
 
     // Return if key is one of the auxiliary keys
     if ((col == 3 && row == 2) || (col == 2 && row == 2))
         return;
 
-    uint8_t keyPressed;
-    uint8_t keyData;
+    uint16_t key = 1 << KEY_INDEX(col, row);
+    if (restartMacros & key)
+        return;
+    if (activeMacros & key) {
+        run->again = 1;
+        return;
+    }
+    startMacro(col, row);
+}
+
+/* mergeReport()
+ * -------------
+ * Merges the HID report of one macro into the combined HID report.
+ *
+ * merged: a pointer to the combined HID report of 8 bytes.
+ * hidReport: a pointer to the HID report of 8 bytes to merge.
+ * first: whether this is the first report merged, which is just copied.
+ */
+static void mergeReport(uint8_t* merged, uint8_t* hidReport, uint8_t first)
+{
+    if (first) {
+        memcpy(merged, hidReport, KEYS_PER_ACTION);
+        return;
+    }
+
+    merged[0] |= hidReport[0];
+    for (uint8_t i = 2; i < KEYS_PER_ACTION; i++) {
+        if (hidReport[i] != EMPTY_KEY)
+            modifyReport(merged, hidReport[i], PRESSED);
+    }
+}
+
+/* pressedKey()
+ * ------------
+ * Checks whether a HID report presses a key that the report before it did
+ * not.
+ *
+ * previous: a pointer to the HID report of 8 bytes before.
+ * hidReport: a pointer to the HID report of 8 bytes after.
+ *
+ * Returns: 1 if a key or modifier was pressed, otherwise 0.
+ */
+static uint8_t pressedKey(uint8_t* previous, uint8_t* hidReport)
+{
+    if (hidReport[0] & ~previous[0])
+        return 1;
+    for (uint8_t i = 2; i < KEYS_PER_ACTION; i++) {
+        if (hidReport[i] != EMPTY_KEY && hidReport[i] != previous[i])
+            return 1;
+    }
+    return 0;
+}
+
+/* timeBurst()
+ * -----------
+ * Times the burst of reports sent while macros run. The burst starts when
+ * its first report is queued and ends once no macro is running and every
+ * report has been sent, when its rate is kept for sendMacroPacing().
+ *
+ * now: the current time in ms.
+ * queued: whether a report is being queued.
+ */
+static void timeBurst(uint32_t now, uint8_t queued)
+{
+    if (queued && !burst) {
+        burst = 1;
+        burstStart = now;
+        burstSent = reportsSent;
+    }
+    if (queued || !burst || activeMacros || restartMacros || releasePending
+        || reportHead != reportTail)
+        return;
+
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t sent = reportsSent - burstSent;
+    uint32_t elapsed = lastReportTime - burstStart;
+    SREG = sreg;
+
+    reportRate = elapsed ? (uint32_t)sent * 1000 / elapsed : 0;
+    burst = 0;
+}
+
+/* runMacros()
+ * -----------
+ * Queues the next action of every running macro as one merged HID report for
+ * seeeduino. Keys of macros that finish are released in the next report. The
+ * macros only advance while there is space in the report queue, so this never
+ * waits for seeeduino and can be called on every pass of the main loop. A
+ * macro with a gap or hold time only advances once its next report is due
+ * by the ms timer, holding its keys in the meantime.
+ */
+void runMacros(void)
+{
+    uint32_t now = getCurrentTime();
+    sendQueuedReport();
+    timeBurst(now, 0);
+    for (uint8_t i = 0; i < STREAMS; i++) {
+        if (streams[i].run)
+            fillStream(&streams[i]);
+    }
+
+    if (!activeMacros && !restartMacros && !releasePending)
+        return;
+    if ((reportHead + 1) % REPORT_QUEUE == reportTail)
+        return;
 
-    // Initialise empty HID report.
     uint8_t hidReport[KEYS_PER_ACTION];
     for (uint8_t i = 0; i < KEYS_PER_ACTION; i++)
         hidReport[i] = EMPTY_KEY;
 
-    // Iterate through all actions in report.
-    for (uint8_t action = 0; action < numOfActions; action++) {
+    uint8_t first = 1;
+    uint8_t advanced = 0;
+    uint8_t waiting = 0;
+    uint16_t finished = 0;
+    for (uint8_t key = 0; key < KEYS; key++) {
+        if (!(activeMacros & (1 << key)))
+            continue;
+
+        uint8_t col = key / ROWS;
+        uint8_t row = key % ROWS;
+        struct MacroRun* run = &runs[col][row];
+        struct MacroData* macro = &macros[col][row];
+        struct MacroStream* stream = findStream(run);
+        uint8_t ended;
+
+        // Hold the keys of a paced macro until its next report is due.
+        if ((int16_t)((uint16_t)now - run->due) < 0) {
+            mergeReport(hidReport, run->hidReport, first);
+            first = 0;
+            waiting = 1;
+            continue;
+        }
 
-        // Get the HID code for the key in the action.
-        keyPressed = macros[col][row].actionsReport[action][0];
+        uint8_t previous[KEYS_PER_ACTION];
+        memcpy(previous, run->hidReport, KEYS_PER_ACTION);
+        if (stream) {
+            // Hold the keys of a macro run from EEPROM until its next token
+            // has been read or its delay is over.
+            uint8_t step = streamReport(stream, run->hidReport);
+            if (step == STREAM_WAITING)
+                waiting = 1;
+            if (step == STREAM_ENDED) {
+                finished |= (1 << key);
+                if (run->again)
+                    restartMacros |= (1 << key);
+                continue;
+            }
+            ended = step == STREAM_CHANGED && streamDone(stream);
+            advanced |= step == STREAM_CHANGED;
+        } else {
+            // Stop the macro if its actions were changed while it was
+            // running, or finish a paced macro once its last report is due.
+            uint8_t numReports = macro->numOfReports;
+            if (run->action >= numReports) {
+                finished |= (1 << key);
+                if (run->again && numReports)
+                    restartMacros |= (1 << key);
+                continue;
+            }
 
-        // Get the encoded byte with data about the action.
-        keyData = macros[col][row].actionsReport[action][1];
+            // Update the macro's HID report to the next compiled report.
+            uint8_t* report = reportPool[macro->firstReport + run->action];
+            run->action++;
+            if (report[REPORT_SLOT] == RELEASE_ALL_KEYS)
+                memset(run->hidReport, EMPTY_KEY, KEYS_PER_ACTION);
+            else
+                run->hidReport[report[REPORT_SLOT]] = report[REPORT_VALUE];
+            ended = run->action >= numReports;
+            advanced = 1;
+        }
+        mergeReport(hidReport, run->hidReport, first);
+        first = 0;
+
+        // Time the next report of a paced macro, which also finishes only
+        // once it is due so its last keys are held as long.
+        if (memcmp(previous, run->hidReport, KEYS_PER_ACTION)) {
+            uint8_t gap = macro->gap;
+            if (macro->hold > gap && pressedKey(previous, run->hidReport))
+                gap = macro->hold;
+            run->due = now + gap;
+            if (gap)
+                ended = 0;
+        }
 
-        // Empty the HID report if the action is to release all keys.
-        if (keyPressed == RELEASE_ALL_KEYS) {
-            for (uint8_t i = 0; i < KEYS_PER_ACTION; i++)
-                hidReport[i] = EMPTY_KEY;
+        // Release the keys of a repeated macro before it runs again.
+        if (ended) {
+            finished |= (1 << key);
+            if (run->again)
+                restartMacros |= (1 << key);
         }
+    }
 
-        // Modify the HID report with data for current action and send it.
-        modifyReport(hidReport, keyPressed, keyData);
-        sendReport(hidReport);
+    // Only send a report when a macro moved on, not while all of them are
+    // waiting for their tokens or delays.
+    if (waiting && !advanced && !finished)
+        return;
+
+    activeMacros &= ~finished;
+    uint16_t restart = restartMacros & ~finished;
+    timeBurst(now, 1);
+    queueReport(hidReport);
+    sendQueuedReport();
+
+    // Send a release of all keys after the last macro has finished.
+    if (finished)
+        releasePending = 1;
+    else if (!activeMacros)
+        releasePending = 0;
+
+    // Free the streams of finished macros that are not run again.
+    for (uint8_t i = 0; i < STREAMS; i++) {
+        if (!streams[i].run)
+            continue;
+        uint8_t key = streams[i].run - &runs[0][0];
+        if ((finished & ~restartMacros) & (1 << key))
+            streams[i].run = NULL;
     }
-    sendRelease();
+
+    // Restart repeated macros whose keys have now been released, a gap
+    // after the release.
+    for (uint8_t key = 0; key < KEYS; key++) {
+        if (!(restart & (1 << key)))
+            continue;
+        uint8_t col = key / ROWS;
+        uint8_t row = key % ROWS;
+        startMacro(col, row);
+        runs[col][row].due = now + macros[col][row].gap;
+    }
+    restartMacros &= ~restart;
 }
 
 /* sendRelease()
  * -------------
- * Sends a release of all keys as HID report to seeeduino.
+ * Queues a release of all keys as HID report to seeeduino.
  */
 void sendRelease(void)
 {
@@ -266,7 +1360,14 @@ void sendRelease(void)
     for (uint8_t i = 0; i < KEYS_PER_ACTION; i++)
         hidReport[i] = EMPTY_KEY;
 
-    sendReport(hidReport);
+    queueReport(hidReport);
+    sendQueuedReport();
+}
+
+// Send the next queued HID report when the IDLE pin of seeeduino goes high.
+ISR(PCINT2_vect)
+{
+    sendQueuedReport();
 }
 
 /* turnOffLed()
@@ -298,26 +1399,31 @@ void turnOnLed(uint8_t col, uint8_t row)
 
 /* displayMacroName()
  * ------------------
- * Displays the macro name on the LCD display.
+ * Displays the macro name on the LCD display in place of the text shown
+ * before, or clears the text if the key has no macro.
  *
  * col: the column of macro key to set.
  * row: the row of macro key to set.
  */
 void displayMacroName(uint8_t col, uint8_t row)
 {
-    uint8_t nameLength = strlen(macros[col][row].name);
-    if (!macros[col][row].numOfActions)
+    uint8_t key = KEY_NUMBER(col, row);
+    drawText(TEXT_SECOND, "", 0, 0);
+    if (key > 10 || !macros[col][row].numOfActions) {
+        drawText(TEXT_FIRST, "", 0, 0);
         return;
+    }
 
-    uint8_t x = 80; // Default x position for text.
-    uint8_t y = 55; // Default y position for text.
-
-    uint8_t size = 3; // Default offset for positioning text.
-    if (nameLength < 14)
-        size = 5;
-
-    x = x - (nameLength * size); // New x position based on name length.
-    drawText(macros[col][row].name, x, y);
+    // Every key is laid out when it is loaded.
+    char name[MAX_CHARACTERS];
+    struct TextLayout* layout = &nameLayouts[key - 1];
+    struct StoredKey stored;
+    findKey(key, &stored);
+    for (uint8_t i = 0; i < layout->length; i++)
+        name[i] = eepromRead(stored.name + i);
+    name[layout->length] = 0x00;
+    namesShown++;
+    drawLayout(TEXT_FIRST, name, layout);
 }
 
 /* sendMacroData()
@@ -343,9 +1449,10 @@ void sendMacroData(void)
         usartTransmit(numActions);
 
         // Send all character of name which are not 0x00.
-        uint8_t length = strlen(macros[col][row].name);
+        char name[MAX_CHARACTERS];
+        uint8_t length = readName(key, name);
         for (uint8_t i = 0; i < length; i++)
-            usartTransmit(macros[col][row].name[i]);
+            usartTransmit(name[i]);
 
         // Then send 0x00 for empty characters of name.
         for (uint8_t i = length; i < 30; i++)
@@ -356,148 +1463,481 @@ void sendMacroData(void)
         usartTransmit(macros[col][row].green);
         usartTransmit(macros[col][row].blue);
 
-        // Send actions.
+        // Send actions, decoded from the tokens they are stored as.
+        struct StoredKey stored;
+        findKey(key, &stored);
+        struct ActionReader reader = { .address = stored.tokens };
         for (uint8_t i = 0; i < numActions; i++) {
-            usartTransmit(macros[col][row].actionsReport[i][0]);
-            usartTransmit(macros[col][row].actionsReport[i][1]);
+            uint8_t action[BYTES_PER_ACTION];
+            readAction(&reader, action);
+            usartTransmit(action[0]);
+            usartTransmit(action[1]);
         }
     }
 }
 
-/* receiveMacroData()
- * ------------------
- * Receives and sorts through all macro data received from GUI through USART.
- * Format to receive data is similar to how data is sent to GUI.
+/* sendMacroPacing()
+ * -----------------
+ * Sends the pacing of every key and the rate HID reports were sent at to GUI
+ * through USART. Format to send is 'P', then the gap and hold time in ms of
+ * keys 1 to 10, then the reports per second measured over the last burst of
+ * macros (2 bytes, high byte first).
+ */
+void sendMacroPacing(void)
+{
+    usartTransmit('P');
+    uint8_t matrixLocation[2];
+    for (uint8_t key = 1; key <= 10; key++) {
+        uint8_t* keyIndex = keyLocation(matrixLocation, key);
+        usartTransmit(macros[keyIndex[0]][keyIndex[1]].gap);
+        usartTransmit(macros[keyIndex[0]][keyIndex[1]].hold);
+    }
+    usartTransmit(reportRate >> 8);
+    usartTransmit(reportRate);
+}
+
+/* sendNameLayouts()
+ * -----------------
+ * Sends how often macro names were laid out and how often they were shown with
+ * their layout to GUI through USART. Format to send is 'L', then the number
+ * of names shown and the number of names laid out as keys were loaded (2
+ * bytes each, high byte first).
+ */
+void sendNameLayouts(void)
+{
+    usartTransmit('L');
+    usartTransmit(namesShown >> 8);
+    usartTransmit(namesShown);
+    usartTransmit(namesLaidOut >> 8);
+    usartTransmit(namesLaidOut);
+}
+
+/* sendImageSize()
+ * ---------------
+ * Sends the size of the macro image to GUI through USART, so it can check a
+ * configuration fits before sending it. Format to send is 'S', then the
+ * number of bytes in the current image, 0 before the first image is stored,
+ * and the most bytes an image can hold (2 bytes each, high byte first).
+ */
+void sendImageSize(void)
+{
+    uint16_t length = oldLayout ? 0 : imageLength();
+    usartTransmit('S');
+    usartTransmit(length >> 8);
+    usartTransmit(length);
+    usartTransmit(IMAGE_CAPACITY >> 8);
+    usartTransmit(IMAGE_CAPACITY & 0xFF);
+}
+
+/* recordLength()
+ * --------------
+ * Gets the length of a record of a field received from GUI.
  *
- * data: a pointer to an array with all the data received from USART.
+ * record: the index of the record in pending[].
  *
- * Returns: the index of the last byte read from data.
+ * Returns: the number of bytes in the record.
  */
-uint16_t receiveMacroData(uint8_t* data)
+static uint16_t recordLength(uint16_t record)
 {
-    uint16_t counter = 0;
-    for (uint8_t keyNum = 1; keyNum <= 10; keyNum++) {
-        // Ignore 'M' character
-        counter++;
-
-        // Get key's row and col based on received macro number
-        uint8_t key = data[counter++];
-        uint8_t* keyIndex;
-        uint8_t matrixLocation[2];
-        keyIndex = keyLocation(matrixLocation, key);
-        uint8_t col = keyIndex[0];
-        uint8_t row = keyIndex[1];
+    if (pending[record] == MACRO_NAME)
+        return 3 + pending[record + 2];
+    if (pending[record] == MACRO_COLOUR)
+        return 2 + 3;
+    if (pending[record] == MACRO_PACING)
+        return 2 + 2;
+    return 4 + pending[record + 3] * BYTES_PER_ACTION;
+}
 
-        setMacroNumActions(col, row, data[counter++]);
-        uint8_t numActions = getMacroNumActions(col, row);
+/* findPending()
+ * -------------
+ * Finds the newest record of a field of a key received from GUI.
+ *
+ * field: the letter of the field, MACRO_NAME, MACRO_COLOUR, MACRO_PACING or
+ *     MACRO_ACTIONS.
+ * key: the key number.
+ *
+ * Returns: the index of the record in pending[], or NO_RECORD if the field
+ *     was not received.
+ */
+static uint16_t findPending(uint8_t field, uint8_t key)
+{
+    uint16_t found = NO_RECORD;
+    for (uint16_t record = 0; record < pendingLength;
+         record += recordLength(record)) {
+        if (pending[record] == field && pending[record + 1] == key)
+            found = record;
+    }
+    return found;
+}
 
-        char name[31];
-        uint8_t colour[3];
+/* addByte()
+ * ---------
+ * Adds a byte to the record being received.
+ *
+ * byte: the byte to add.
+ *
+ * Returns: 1 if the byte was added, or 0 if there is no room.
+ */
+static uint8_t addByte(uint8_t byte)
+{
+    if (incomingEnd >= PENDING_SIZE)
+        return 0;
+    pending[incomingEnd++] = byte;
+    return 1;
+}
 
-        // Get name
-        for (uint8_t i = 0; i < 30; i++)
-            name[i] = data[counter++];
-        name[30] = 0x00;
+/* startRecord()
+ * -------------
+ * Starts a record of a field of the key being received.
+ *
+ * field: the letter of the field, MACRO_NAME, MACRO_COLOUR, MACRO_PACING or
+ *     MACRO_ACTIONS.
+ *
+ * Returns: 1 if the record was started, or 0 if there is no room.
+ */
+static uint8_t startRecord(uint8_t field)
+{
+    incomingRecord = incomingEnd;
+    incomingRaw = 0;
+    incomingMerge = incomingRecord + 4;
+    return addByte(field) && addByte(incomingKey);
+}
 
-        // Get colour data
-        for (uint8_t i = 0; i < 3; i++)
-            colour[i] = data[counter++];
+/* addAction()
+ * -----------
+ * Adds an action received from GUI to the tokens of the actions record being
+ * received. A release straight after a press of the same key turns the press
+ * into a tap, which adds to a tap of the same key before it, and an action
+ * the same as the token before it repeats that token. Only the MODIFIER and
+ * PRESSED bits of the data are kept, except for an instruction and the
+ * tokens of its characters or keys, which are kept as they are and never
+ * merged. A chord of more than CHORD_KEYS keys or a repeat of 0 times is
+ * refused, as it could not be run as sent.
+ *
+ * key: the key of the action.
+ * data: the data byte of the action.
+ *
+ * Returns: 1 if the action was added, or 0 if there is no room or the
+ *     instruction is refused.
+ */
+static uint8_t addAction(uint8_t key, uint8_t data)
+{
+    if (!incomingRaw && (data & TOKEN_INSTRUCTION) == TOKEN_INSTRUCTION) {
+        uint8_t instruction = data & TOKEN_COUNT;
+        if ((instruction == OP_CHORD && key > CHORD_KEYS)
+            || (instruction == OP_REPEAT && !key))
+            return 0;
+    }
+    if (incomingRaw || (data & TOKEN_INSTRUCTION) == TOKEN_INSTRUCTION) {
+        incomingRaw = incomingRaw ? incomingRaw - 1 : operandTokens(key, data);
+        if (!addByte(key) || !addByte(data))
+            return 0;
+        pending[incomingRecord + 3]++;
+        incomingMerge = incomingEnd;
+        return 1;
+    }
 
-        // Get macro action data
-        uint8_t macroActions[numActions][BYTES_PER_ACTION];
-        for (uint8_t i = 0; i < numActions; i++) {
-            macroActions[i][0] = data[counter++];
-            macroActions[i][1] = data[counter++];
+    uint8_t control = data & (MODIFIER | PRESSED);
+    uint16_t tokens = incomingMerge;
+    uint8_t* last = NULL;
+    uint8_t* before = NULL;
+    if (incomingEnd >= tokens + BYTES_PER_ACTION)
+        last = &pending[incomingEnd - BYTES_PER_ACTION];
+    if (incomingEnd >= tokens + 2 * BYTES_PER_ACTION)
+        before = &pending[incomingEnd - 2 * BYTES_PER_ACTION];
+
+    if (last && last[0] == key && !(control & PRESSED)
+        && last[1] == (control | PRESSED)) {
+        if (before && before[0] == key
+            && (before[1] & ~TOKEN_COUNT) == (control | TOKEN_TAP)
+            && (before[1] & TOKEN_COUNT) < TOKEN_COUNT) {
+            before[1]++;
+            incomingEnd -= BYTES_PER_ACTION;
+            pending[incomingRecord + 3]--;
+        } else {
+            last[1] = control | TOKEN_TAP;
         }
+        return 1;
+    }
 
-        setMacroName(col, row, name);
-        setMacroColour(col, row, colour[0], colour[1], colour[2]);
-        setMacroAction(col, row, macroActions);
+    if (last && last[0] == key && (last[1] & ~TOKEN_COUNT) == control
+        && (last[1] & TOKEN_COUNT) < TOKEN_COUNT) {
+        last[1]++;
+        return 1;
     }
-    return counter;
+
+    if (!addByte(key) || !addByte(control))
+        return 0;
+    pending[incomingRecord + 3]++;
+    return 1;
 }
 
-/* storeMacroData()
- * ----------------
- * Stores all macro data to EEPROM.
+/* receiveMacroStart()
+ * --------------------
+ * Prepares to decode a key or one field of a key received from GUI.
+ *
+ * field: the letter that starts the data, MACRO_KEY, MACRO_NAME,
+ *     MACRO_COLOUR, MACRO_PACING or MACRO_ACTIONS.
  */
-void storeMacroData(void)
+void receiveMacroStart(uint8_t field)
 {
-    for (uint8_t key = 1; key <= 10; key++) {
-        uint8_t* keyIndex;
-        uint8_t matrixLocation[2];
-        keyIndex = keyLocation(matrixLocation, key); // Get matrix location of key.
-        uint8_t col = keyIndex[0];
-        uint8_t row = keyIndex[1];
+    incomingField = field;
+    incomingIndex = 0;
+    incomingLength = 0xFFFF;
+    incomingEnd = pendingLength;
+}
 
-        // Store name.
-        for (uint8_t i = 0; i < 30; i++) {
-            eepromWrite(NAME_ADDRESS + ((key - 1) * 30) + i,
-                macros[col][row].name[i]);
+/* receiveMacroByte()
+ * ------------------
+ * Decodes the next byte of a key or one field of a key received from GUI.
+ * Called from the USART receive interrupt, so the data is never buffered as
+ * sent. A whole key (MACRO_KEY) is sent the same way as sendMacroData(). A
+ * single field is its letter, the key number, then 30 characters for
+ * MACRO_NAME, 3 bytes for MACRO_COLOUR, the gap and hold time in ms for
+ * MACRO_PACING, or the number of actions and 2 bytes per action for
+ * MACRO_ACTIONS. The data is packed into records in pending[]
+ * as it arrives, names without their padding and actions as tokens, and
+ * nothing is used until storeMacroData() stores it.
+ *
+ * byte: the byte received, starting with the letter of the field.
+ *
+ * Returns: MACRO_BUSY while more bytes are needed, MACRO_DONE once the key or
+ *     field has been received, MACRO_ERROR if the data is malformed or
+ *     MACRO_FULL if it does not fit.
+ */
+uint8_t receiveMacroByte(uint8_t byte)
+{
+    uint16_t index = incomingIndex++;
+
+    // Position of the byte in a whole key, which the fields are parts of.
+    uint16_t position = index;
+    if (incomingField == MACRO_NAME && index > 1)
+        position += 1;
+    else if (incomingField == MACRO_COLOUR && index > 1)
+        position += 31;
+    else if (incomingField == MACRO_ACTIONS && index > 2)
+        position += 33;
+
+    uint8_t added = 1;
+    if (position == 0) {
+        if (byte != MACRO_KEY && byte != MACRO_NAME && byte != MACRO_COLOUR
+            && byte != MACRO_ACTIONS && byte != MACRO_PACING)
+            return MACRO_ERROR;
+    } else if (position == 1) {
+        if (byte < 1 || byte > 10)
+            return MACRO_ERROR;
+        incomingKey = byte;
+        if (incomingField == MACRO_NAME)
+            incomingLength = 2 + 30;
+        else if (incomingField == MACRO_COLOUR)
+            incomingLength = 2 + 3;
+        else if (incomingField == MACRO_PACING)
+            incomingLength = 2 + 2;
+        if (incomingField == MACRO_KEY || incomingField == MACRO_NAME)
+            added = startRecord(MACRO_NAME) && addByte(0);
+        else if (incomingField == MACRO_PACING)
+            added = startRecord(MACRO_PACING);
+    } else if (incomingField == MACRO_PACING) {
+        // The pacing is not part of a whole key.
+        added = addByte(byte);
+    } else if (position == 2) {
+        incomingActions = byte;
+        incomingLength = byte * BYTES_PER_ACTION
+            + (incomingField == MACRO_KEY ? MACRO_RECORD : 3);
+        if (incomingField == MACRO_ACTIONS)
+            added = startRecord(MACRO_ACTIONS) && addByte(byte) && addByte(0);
+    } else if (position < 3 + 30) {
+        // The name ends at its first 0x00.
+        if (byte && pending[incomingRecord + 2] == position - 3) {
+            added = addByte(byte);
+            pending[incomingRecord + 2] += added;
         }
-
-        // Store colour.
-        uint8_t colour[3];
-        colour[0] = macros[col][row].red;
-        colour[1] = macros[col][row].green;
-        colour[2] = macros[col][row].blue;
-        for (uint8_t i = 0; i < 3; i++)
-            eepromWrite(COLOUR_ADDRESS + ((key - 1) * 3) + i, colour[i]);
-
-        // Store number of actions.
-        eepromWrite(NUM_ACTIONS_ADDRESS + ((key - 1) * 1),
-            macros[col][row].numOfActions);
-
-        // Store all actions.
-        for (uint8_t i = 0; i < macros[col][row].numOfActions; i++) {
-            eepromWrite(ACTIONS_ADDRESS + ((key - 1) * 40) + 0 + (i * 2),
-                macros[col][row].actionsReport[i][0]);
-            eepromWrite(ACTIONS_ADDRESS + ((key - 1) * 40) + 1 + (i * 2),
-                macros[col][row].actionsReport[i][1]);
+    } else if (position == 33) {
+        added = startRecord(MACRO_COLOUR) && addByte(byte);
+    } else if (position < MACRO_RECORD) {
+        added = addByte(byte);
+        if (position == MACRO_RECORD - 1 && incomingField == MACRO_KEY) {
+            added = added && startRecord(MACRO_ACTIONS)
+                && addByte(incomingActions) && addByte(0);
         }
+    } else if ((position - MACRO_RECORD) % BYTES_PER_ACTION == 0) {
+        incomingAction = byte;
+    } else {
+        added = addAction(incomingAction, byte);
     }
+    if (!added)
+        return incomingEnd < PENDING_SIZE ? MACRO_ERROR : MACRO_FULL;
+
+    if (index + 1 < incomingLength)
+        return MACRO_BUSY;
+
+    // Only whole keys and fields are stored.
+    pendingLength = incomingEnd;
+    return MACRO_DONE;
 }
 
-/* getMacroData()
- * --------------
- * Retrieves all macro data from EEPROM.
+/* writeImage()
+ * ------------
+ * Writes every key to a new image, with the fields received from GUI taken
+ * from pending[] and the other fields copied from the current image. The
+ * first image is written over the old layout, which is safe as the names are
+ * read into the report pool first, colours, pacing and numbers of actions are
+ * in macros[][], and keys are written in order so no key's record reaches the
+ * old actions of the keys after it. The old layout spans both banks, so this
+ * first image has no untouched copy to fall back on: a power loss before its
+ * header is written loses the macro data of every key.
+ *
+ * Returns: 1 if the image was written, or 0 if it does not fit in a bank.
  */
-void getMacroData(void)
+static uint8_t writeImage(void)
 {
-    for (uint8_t key = 1; key <= 10; key++) {
-        uint8_t* keyIndex;
-        uint8_t matrixLocation[2];
-        keyIndex = keyLocation(matrixLocation, key); // Get matrix location of key.
-        uint8_t col = keyIndex[0];
-        uint8_t row = keyIndex[1];
-
-        // Get name.
-        char name[31];
-        for (uint8_t i = 0; i < 30; i++) {
-            name[i] = eepromRead((uint16_t)NAME_ADDRESS + ((key - 1) * 30) + i);
+    char* oldNames = (char*)reportPool;
+    if (oldLayout) {
+        for (uint8_t key = 1; key <= 10; key++) {
+            unloadMacro(key);
+            readName(key, &oldNames[(key - 1) * MAX_CHARACTERS]);
         }
-        name[30] = 0x00;
-        setMacroName(col, row, name);
+        poolUsed = 0;
+    }
 
-        // Get colour.
-        uint8_t colour[3];
-        for (uint8_t i = 0; i < 3; i++) {
-            colour[i] = eepromRead((uint16_t)COLOUR_ADDRESS + ((key - 1) * 3) + i);
+    // Find the length of the image, then write it.
+    uint16_t length = 0;
+    uint8_t matrixLocation[2];
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        if (pass) {
+            if (length > IMAGE_CAPACITY)
+                return 0;
+            imageBegin();
         }
-        setMacroColour(col, row, colour[0], colour[1], colour[2]);
 
-        // Get number of actions.
-        uint8_t numActions = eepromRead((uint16_t)NUM_ACTIONS_ADDRESS + ((key - 1) * 1));
-        setMacroNumActions(col, row, numActions);
+        for (uint8_t key = 1; key <= 10; key++) {
+            uint8_t* keyIndex = keyLocation(matrixLocation, key);
+            struct MacroData* macro = &macros[keyIndex[0]][keyIndex[1]];
+            struct StoredKey stored;
+            findKey(key, &stored);
+            uint16_t name = findPending(MACRO_NAME, key);
+            uint16_t colour = findPending(MACRO_COLOUR, key);
+            uint16_t pacing = findPending(MACRO_PACING, key);
+            uint16_t actions = findPending(MACRO_ACTIONS, key);
+
+            char* oldName = &oldNames[(key - 1) * MAX_CHARACTERS];
+            uint8_t nameLength = stored.nameLength;
+            if (name != NO_RECORD)
+                nameLength = pending[name + 2];
+            else if (oldLayout)
+                nameLength = strlen(oldName);
+
+            uint8_t numActions = macro->numOfActions;
+            uint8_t numTokens = oldLayout ? numActions : stored.numTokens;
+            if (actions != NO_RECORD) {
+                numActions = pending[actions + 2];
+                numTokens = pending[actions + 3];
+            }
 
-        // Get all actions of macro.
-        uint8_t macroActions[MAX_ACTIONS][BYTES_PER_ACTION];
-        for (uint8_t i = 0; i < numActions; i++) {
-            macroActions[i][0] = eepromRead((uint16_t)ACTIONS_ADDRESS
-                + ((key - 1) * 40) + 0 + (i * 2));
-            macroActions[i][1] = eepromRead((uint16_t)ACTIONS_ADDRESS
-                + ((key - 1) * 40) + 1 + (i * 2));
+            if (!pass) {
+                length += KEY_RECORD + nameLength
+                    + numTokens * BYTES_PER_ACTION;
+                continue;
+            }
+
+            uint16_t address = imageWrite(numActions);
+            imageWrite(nameLength);
+            for (uint8_t i = 0; i < nameLength; i++) {
+                if (name != NO_RECORD)
+                    imageWrite(pending[name + 3 + i]);
+                else if (oldLayout)
+                    imageWrite(oldName[i]);
+                else
+                    imageWrite(eepromRead(stored.name + i));
+            }
+
+            if (colour != NO_RECORD) {
+                for (uint8_t i = 0; i < 3; i++)
+                    imageWrite(pending[colour + 2 + i]);
+            } else {
+                imageWrite(macro->red);
+                imageWrite(macro->green);
+                imageWrite(macro->blue);
+            }
+
+            if (pacing != NO_RECORD) {
+                imageWrite(pending[pacing + 2]);
+                imageWrite(pending[pacing + 3]);
+            } else {
+                imageWrite(macro->gap);
+                imageWrite(macro->hold);
+            }
+
+            imageWrite(numTokens);
+            for (uint16_t i = 0; i < numTokens * BYTES_PER_ACTION; i++) {
+                if (actions != NO_RECORD)
+                    imageWrite(pending[actions + 4 + i]);
+                else
+                    imageWrite(eepromRead(stored.tokens + i));
+            }
+            keyAddress[key - 1] = address;
         }
-        setMacroAction(col, row, macroActions);
     }
+    imageCommit();
+    oldLayout = 0;
+    return 1;
+}
+
+/* storeMacroData()
+ * ----------------
+ * Stores the fields of every key received from GUI as a new image in EEPROM,
+ * then reads the keys received back from it so their colours are shown. Only
+ * keys whose actions were received are unloaded, so their actions are
+ * compiled again the next time they run. The current image is
+ * left whole until the new image is committed, so a power loss while storing
+ * keeps the macro data from before the frame, except for the first image
+ * written over the old layout (see writeImage()).
+ *
+ * Returns: 1 if the data was stored, or 0 if it does not fit in EEPROM.
+ */
+uint8_t storeMacroData(void)
+{
+    if (!pendingLength)
+        return 1;
+    if (!writeImage())
+        return 0;
+
+    for (uint16_t record = 0; record < pendingLength;
+         record += recordLength(record)) {
+        if (pending[record] == MACRO_ACTIONS)
+            unloadMacro(pending[record + 1]);
+        loadMacroSummary(pending[record + 1]);
+    }
+    moveStreams();
+    pendingLength = 0;
+    return 1;
+}
+
+/* getMacroData()
+ * --------------
+ * Retrieves the colour and number of actions of every key from the newest
+ * valid image in EEPROM, or from the layout used before the image if there
+ * is none. The old layout is moved into an image by the first frame stored.
+ */
+void getMacroData(void)
+{
+    oldLayout = !imageLoad();
+    loadedKeys = 0;
+    poolUsed = 0;
+    uint16_t address = imageAddress();
+    for (uint8_t key = 1; key <= 10; key++) {
+        keyAddress[key - 1] = address;
+        address += loadMacroSummary(key);
+    }
+}
+
+/* discardMacroData()
+ * ------------------
+ * Drops the fields received from GUI when the rest of the frame is rejected
+ * or the data does not fit in EEPROM. Nothing received is used until it is
+ * stored, so there is nothing to restore.
+ */
+void discardMacroData(void)
+{
+    pendingLength = 0;
 }
\ No newline at end of file
@@ -7,28 +7,85 @@
 #pragma once
 
 #define F_CPU 11059200L
-#define MAX_ACTIONS 20 // Max number of actions for macro.
+#define MAX_ACTIONS 255 // Max number of actions for macro, sent as 1 byte.
 #define KEYS_PER_ACTION 8 // Number of bytes for HID report.
 #define BYTES_PER_ACTION 2 // Number of bytes to store per macro action.
+#define REPORT_SLOT 0 // Index of HID report byte changed by compiled report.
+#define REPORT_VALUE 1 // Index of new value of byte in compiled report.
 #define MAX_CHARACTERS 31 // Length of macro name including '\0' character.
+#define MACRO_RECORD 36 // Bytes received per key before its actions.
+#define NAME_X 80 // Position in x-axis names are centred on.
+#define NAME_Y 55 // Position in y-axis names are drawn at.
 
 #define MODIFIER (1 << 7) // Bit that indicates whether key is modifier.
 #define PRESSED (1 << 6) // Bit that indicates whether key is pressed or not.
 #define RELEASE_ALL_KEYS 0xFF // Action to indicate to send release all keys.
 #define EMPTY_KEY 0x00
 
-#define HID_DELAY 20
+// Actions are stored as tokens of the key and a control byte with the
+// MODIFIER and PRESSED bits of the action, so a single action is its own
+// token. A token can stand for a tap (press then release) and be repeated.
+#define TOKEN_TAP (1 << 5) // Token is a press then release of the key.
+#define TOKEN_COUNT 0x1F // Bits with the number of repeats of the token - 1.
+
+// A token with both TOKEN_TAP and PRESSED set is an instruction, with the
+// instruction in bits 4-0 and its operand as the key. OP_STRING and OP_CHORD
+// are followed by their characters or keys, two per token. Instructions are
+// sent by the GUI as actions with the same two bytes.
+#define TOKEN_INSTRUCTION (TOKEN_TAP | PRESSED)
+#define OP_DELAY 0 // Holds the keys for operand * DELAY_UNIT ms.
+#define OP_STRING 1 // Types operand ASCII characters.
+#define OP_REPEAT 2 // Runs the tokens up to OP_END operand (1+) times, not nested.
+#define OP_END 3 // Ends the tokens repeated by OP_REPEAT.
+#define OP_CHORD 4 // Presses operand keys in one report, then releases them.
+#define DELAY_UNIT 10 // Number of ms per unit of OP_DELAY.
+#define CHORD_KEYS 6 // Max keys of OP_CHORD, modifiers are keys 0xE0-0xE7.
+
+// Letters that start a key or a field of a key received from GUI.
+#define MACRO_KEY 'M' // Whole key as sent by sendMacroData().
+#define MACRO_NAME 'n' // Name of a key.
+#define MACRO_COLOUR 'c' // Colour of a key.
+#define MACRO_ACTIONS 'a' // Actions of a key.
+#define MACRO_PACING 'p' // Gap and hold time of a key.
+
+// Values returned by receiveMacroByte().
+#define MACRO_BUSY 0 // More bytes of macro data are needed.
+#define MACRO_DONE 1 // The key or field has been received.
+#define MACRO_ERROR 2 // Macro data is malformed.
+#define MACRO_FULL 3 // Macro data does not fit in EEPROM.
+
+#define HID_DELAY 20 // Time in us SS is held low after a HID report.
+#define REPORT_QUEUE 4 // Size of HID report queue, kept short so a macro
+                       // started later is merged in without much delay.
+#define REPORT_POOL 160 // Number of compiled reports kept in RAM.
+#define STREAM_ACTIONS 32 // Macros with more actions are run from EEPROM.
+#define STREAMS 2 // Number of macros that can run from EEPROM at once.
+#define PREFETCH 8 // Tokens read ahead for each macro run from EEPROM.
+#define ACTION_QUEUE (2 * CHORD_KEYS) // Actions an instruction is run as.
 
 #include <stdint.h>
 
-// Struct to store macro data for each macro key.
+// Struct to store macro data for each macro key. The name and actions are
+// kept in EEPROM, the actions are compiled into a shared report pool when
+// the macro is first run unless it is long enough or has instructions, which
+// makes it run from EEPROM.
 struct MacroData {
-    char name[MAX_CHARACTERS];
     uint8_t red;
     uint8_t green;
     uint8_t blue;
-    uint8_t numOfActions;
-    uint8_t actionsReport[MAX_ACTIONS][BYTES_PER_ACTION];
+    uint8_t numOfActions; // Number of actions as received from the GUI.
+    uint8_t numOfReports; // Number of HID reports the actions compile to.
+    uint8_t firstReport; // Index of the first report in the report pool.
+    uint8_t gap; // Min ms between HID reports of the macro, 0 for no limit.
+    uint8_t hold; // Min ms a key pressed by the macro is held down.
+};
+
+// Execution state of a macro that is being sent by runMacros().
+struct MacroRun {
+    uint8_t action; // Index of the next action to send.
+    uint8_t again; // Whether to run the macro again once it finishes.
+    uint16_t due; // Time in ms (low 16 bits) the next report is due.
+    uint8_t hidReport[KEYS_PER_ACTION]; // Keys currently held by the macro.
 };
 
 // Initialises SPI to send HID reports to seeediuno.
@@ -37,23 +94,19 @@ void macrosInit(void);
 // Returns the number of actions in the specified macro key.
 uint8_t getMacroNumActions(uint8_t col, uint8_t row);
 
-// Sets the name of specified macro in macroData.
-void setMacroName(uint8_t col, uint8_t row, char* name);
-
 // Sets the colour of specified macro in macroData.
 void setMacroColour(uint8_t col, uint8_t row, uint8_t r, uint8_t g, uint8_t b);
 
 // Sets the number of actions for specified macro in macroData.
 void setMacroNumActions(uint8_t col, uint8_t row, uint8_t numActions);
 
-// Sets the actions for specified macro in macroData.
-void setMacroAction(uint8_t col, uint8_t row,
-    uint8_t report[MAX_ACTIONS][BYTES_PER_ACTION]);
-
-// Sends all actions of macro as HID report to seeeduino.
+// Starts sending all actions of macro as HID reports to seeeduino.
 void executeMacro(uint8_t col, uint8_t row);
 
-// Sends a release of all keys as HID report to seeeduino.
+// Queues the next action of every running macro as one merged HID report.
+void runMacros(void);
+
+// Queues a release of all keys as HID report to seeeduino.
 void sendRelease(void);
 
 // Turns off the LED for use when blinking them.
@@ -68,11 +121,26 @@ void displayMacroName(uint8_t col, uint8_t row);
 // Sends all the macro data to GUI through USART.
 void sendMacroData(void);
 
-// Receives and sorts through all macro data received from GUI through USART.
-uint16_t receiveMacroData(uint8_t* data);
+// Sends the pacing of every key and the HID report rate to GUI through USART.
+void sendMacroPacing(void);
+
+// Sends how often macro names were laid out and shown through USART.
+void sendNameLayouts(void);
+
+// Sends the bytes used and the capacity of the macro image through USART.
+void sendImageSize(void);
+
+// Prepares to decode a key or one field of a key received from GUI.
+void receiveMacroStart(uint8_t field);
+
+// Decodes the next byte of a key or field received from GUI until stored.
+uint8_t receiveMacroByte(uint8_t byte);
+
+// Stores the fields received from GUI as a new image in EEPROM.
+uint8_t storeMacroData(void);
 
-// Stores all macro data to EEPROM.
-void storeMacroData(void);
+// Drops the fields received from GUI.
+void discardMacroData(void);
 
 // Retrieves all macro data from EEPROM.
 void getMacroData(void);
\ No newline at end of file
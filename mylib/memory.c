@@ -0,0 +1,188 @@
+/*
+ * memory.c
+ *
+ * TEAM 01 ENGG2800
+ */
+
+#include "memory.h"
+#include "hal.h"
+
+// Writes waiting to be programmed by the EEPROM ready interrupt. The write at
+// the tail is being programmed while writing is set.
+static uint16_t queueAddress[EEPROM_QUEUE];
+static uint8_t queueData[EEPROM_QUEUE];
+static volatile uint8_t queueHead;
+static volatile uint8_t queueTail;
+static volatile uint8_t writing;
+
+// Number of bytes programmed since eepromBytesWritten() was last called.
+static volatile uint16_t bytesWritten;
+
+/* eepromWrite()
+ * -------------
+ * Queues a byte to be written to the specified EEPROM address by the EEPROM
+ * ready interrupt, so the caller does not wait for it to be programmed. A
+ * write to an address that is already queued replaces the queued data. Waits
+ * only if the queue is full. Only used from the main program.
+ *
+ * address: the EEPROM address to write to.
+ * data: the byte to write.
+ */
+void eepromWrite(uint16_t address, uint8_t data)
+{
+    // Skip bytes that already hold the data, or will once queued writes end.
+    if (eepromRead(address) == data)
+        return;
+
+    uint8_t queued = 0;
+    while (!queued) {
+        uint8_t sreg = SREG;
+        cli();
+        uint8_t first = queueTail;
+        if (writing)
+            first = (first + 1) % EEPROM_QUEUE;
+        for (uint8_t i = first; i != queueHead; i = (i + 1) % EEPROM_QUEUE) {
+            if (queueAddress[i] == address) {
+                queueData[i] = data;
+                queued = 1;
+            }
+        }
+
+        uint8_t next = (queueHead + 1) % EEPROM_QUEUE;
+        if (!queued && next != queueTail) {
+            queueAddress[queueHead] = address;
+            queueData[queueHead] = data;
+            queueHead = next;
+            queued = 1;
+        }
+
+        if (queued)
+            EECR |= (1 << EERIE);
+        SREG = sreg;
+
+        // Sleep until the interrupt makes space in the queue.
+        if (!queued)
+            sleep_mode();
+    }
+}
+
+/* eepromTryRead()
+ * ---------------
+ * Reads a byte from the specified EEPROM address without waiting. Data queued
+ * to be written to the address is returned as it will be stored.
+ *
+ * address: the EEPROM address to read from.
+ * data: a pointer to the byte to read into.
+ *
+ * Returns: 1 if the byte was read, or 0 if a write is being programmed and
+ *     the address has no queued data.
+ */
+uint8_t eepromTryRead(uint16_t address, uint8_t* data)
+{
+    uint8_t read = 0;
+    uint8_t sreg = SREG;
+    cli();
+    for (uint8_t i = queueTail; i != queueHead; i = (i + 1) % EEPROM_QUEUE) {
+        if (queueAddress[i] == address) {
+            *data = queueData[i];
+            read = 1;
+        }
+    }
+
+    // The EEPROM cannot be read while a write is being programmed.
+    if (!read && !(EECR & (1 << EEPE))) {
+        EEAR = address;
+        EECR |= (1 << EERE);
+        *data = EEDR;
+        read = 1;
+    }
+    SREG = sreg;
+    return read;
+}
+
+/* eepromRead()
+ * ------------
+ * Reads a byte from the specified EEPROM address, waiting for a write being
+ * programmed to finish. Data queued to be written to the address is returned
+ * as it will be stored.
+ *
+ * address: the EEPROM address to read from.
+ *
+ * Returns: the byte stored at the address.
+ */
+uint8_t eepromRead(uint16_t address)
+{
+    uint8_t data = 0;
+    while (!eepromTryRead(address, &data)) { }
+    return data;
+}
+
+/* eepromFlush()
+ * -------------
+ * Waits until every queued write has been programmed, so the data is safe
+ * if power is lost. Only used from the main program.
+ */
+void eepromFlush(void)
+{
+    while (queueTail != queueHead)
+        sleep_mode();
+}
+
+/* eepromBytesWritten()
+ * --------------------
+ * Gets the number of bytes programmed since the last call, which is less than
+ * the number of writes asked for when bytes are unchanged or replaced while
+ * queued.
+ *
+ * Returns: the number of bytes programmed.
+ */
+uint16_t eepromBytesWritten(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t count = bytesWritten;
+    bytesWritten = 0;
+    SREG = sreg;
+    return count;
+}
+
+// Program the next queued write once the previous one has finished. The byte
+// is read back first and left alone if it already holds the data. Otherwise
+// only the erase (sets all bits) or only the write (clears bits) is done when
+// the other is not needed, which takes half the time of doing both.
+ISR(EE_READY_vect)
+{
+    if (writing) {
+        queueTail = (queueTail + 1) % EEPROM_QUEUE;
+        writing = 0;
+    }
+
+    while (queueTail != queueHead) {
+        uint16_t address = queueAddress[queueTail];
+        uint8_t data = queueData[queueTail];
+        EEAR = address;
+        EECR |= (1 << EERE);
+        uint8_t current = EEDR;
+
+        if (current != data) {
+            uint8_t mode = 0; // Erase and write.
+            if (data == 0xFF)
+                mode = (1 << EEPM0); // Erase only.
+            else if ((current & data) == data)
+                mode = (1 << EEPM1); // Write only.
+            EECR = (EECR & ~((1 << EEPM1) | (1 << EEPM0))) | mode;
+
+            // EEPE must be set within 4 cycles of EEMPE.
+            EEDR = data;
+            EECR |= (1 << EEMPE);
+            EECR |= (1 << EEPE);
+            writing = 1;
+            bytesWritten++;
+            return;
+        }
+        queueTail = (queueTail + 1) % EEPROM_QUEUE;
+    }
+
+    // Nothing left to write.
+    EECR &= ~(1 << EERIE);
+}
\ No newline at end of file
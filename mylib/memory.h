@@ -0,0 +1,27 @@
+/*
+ * memory.h
+ *
+ * TEAM 01 ENGG2800
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define EEPROM_QUEUE 16 // Size of queue of bytes waiting to be written.
+
+// Queues a byte to be written to the specified EEPROM address.
+void eepromWrite(uint16_t address, uint8_t data);
+
+// Returns the byte stored at the specified EEPROM address.
+uint8_t eepromRead(uint16_t address);
+
+// Reads the byte stored at the specified EEPROM address if it can be read
+// without waiting.
+uint8_t eepromTryRead(uint16_t address, uint8_t* data);
+
+// Waits until all queued bytes have been written to EEPROM.
+void eepromFlush(void);
+
+// Returns the number of bytes written since it was last called.
+uint16_t eepromBytesWritten(void);
\ No newline at end of file
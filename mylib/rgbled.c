@@ -11,7 +11,7 @@
 #include "light_ws2812.h"
 #include "macros.h"
 #include "ws2812_config.h"
-#include <util/delay.h>
+#include "hal.h"
 
 // Global variable struct for all 10 LEDs to make it easier to set LED
 // colours in the whole program.
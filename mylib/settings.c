@@ -0,0 +1,225 @@
+/*
+ * settings.c
+ *
+ * Team 01 ENGG2800
+ */
+
+#include "settings.h"
+#include "addresses.h"
+#include "memory.h"
+#include "hal.h"
+
+// Each record of the journal is a sequence number, the setting, its value
+// (high byte first) and a CRC-8 of the other bytes, written last so a record
+// that was only partly written is ignored.
+#define RECORD_SEQUENCE 0
+#define RECORD_SETTING 1
+#define RECORD_VALUE 2
+#define RECORD_CRC 4
+#define RECORD_LENGTH 5
+#define RECORD_CRC_INIT 0xFF // So a slot of zeros is not a valid record.
+
+#define NO_RECORD 0xFF // Setting has no record in the journal.
+
+// Newest value of every setting and the slot of its newest record.
+static uint16_t values[SETTINGS];
+static uint8_t newestSlot[SETTINGS];
+
+// Slot and sequence number of the newest record in the journal.
+static uint8_t head;
+static uint8_t headSequence;
+
+/* readRecord()
+ * ------------
+ * Reads a record of the journal and checks it.
+ *
+ * slot: the slot of the record.
+ * record: an array of RECORD_LENGTH bytes to read the record into.
+ *
+ * Returns: 1 if the record is valid, otherwise 0.
+ */
+static uint8_t readRecord(uint8_t slot, uint8_t* record)
+{
+    uint16_t address = SETTINGS_ADDRESS + slot * RECORD_LENGTH;
+    uint8_t crc = RECORD_CRC_INIT;
+    for (uint8_t i = 0; i < RECORD_LENGTH; i++) {
+        record[i] = eepromRead(address + i);
+        if (i < RECORD_CRC)
+            crc = _crc8_ccitt_update(crc, record[i]);
+    }
+    return crc == record[RECORD_CRC] && record[RECORD_SETTING] < SETTINGS;
+}
+
+/* writeRecord()
+ * -------------
+ * Writes a record after the newest record of the journal.
+ *
+ * setting: the setting of the record.
+ * value: the value of the setting.
+ */
+static void writeRecord(uint8_t setting, uint16_t value)
+{
+    head = (head + 1) % SETTINGS_RECORDS;
+    headSequence++;
+    newestSlot[setting] = head;
+
+    uint8_t record[RECORD_LENGTH];
+    record[RECORD_SEQUENCE] = headSequence;
+    record[RECORD_SETTING] = setting;
+    record[RECORD_VALUE] = value >> 8;
+    record[RECORD_VALUE + 1] = value;
+    record[RECORD_CRC] = RECORD_CRC_INIT;
+    for (uint8_t i = 0; i < RECORD_CRC; i++)
+        record[RECORD_CRC] = _crc8_ccitt_update(record[RECORD_CRC], record[i]);
+
+    // Queued writes are programmed in order, so the CRC is written last.
+    uint16_t address = SETTINGS_ADDRESS + head * RECORD_LENGTH;
+    for (uint8_t i = 0; i < RECORD_LENGTH; i++)
+        eepromWrite(address + i, record[i]);
+}
+
+/* appendRecord()
+ * --------------
+ * Writes a record at the head of the journal. The newest record of another
+ * setting in the slot is written again at the head first, so every setting
+ * always keeps a record.
+ *
+ * setting: the setting of the record.
+ * value: the value of the setting.
+ */
+static void appendRecord(uint8_t setting, uint16_t value)
+{
+    uint8_t carried = 1;
+    while (carried) {
+        carried = 0;
+        uint8_t slot = (head + 1) % SETTINGS_RECORDS;
+        for (uint8_t i = 0; i < SETTINGS; i++) {
+            if (newestSlot[i] == slot && i != setting) {
+                writeRecord(i, values[i]);
+                carried = 1;
+                break;
+            }
+        }
+    }
+    writeRecord(setting, value);
+}
+
+/* findHead()
+ * ----------
+ * Finds the newest record of the journal with a binary search, reading about
+ * log2(SETTINGS_RECORDS) records instead of every slot. Records are written
+ * to the slots in turn from slot 0, each with the next sequence number, so
+ * every slot from 0 up to the head holds slot 0's sequence number plus the
+ * slot. Slots after the head hold records from the lap before, which are
+ * SETTINGS_RECORDS behind, or are invalid if never written or cut short by a
+ * power loss.
+ */
+static void findHead(void)
+{
+    uint8_t record[RECORD_LENGTH];
+
+    // A record cut short in slot 0 follows a head in the last slot.
+    head = SETTINGS_RECORDS - 1;
+    headSequence = 0;
+    if (!readRecord(0, record)) {
+        if (readRecord(head, record))
+            headSequence = record[RECORD_SEQUENCE];
+        return;
+    }
+
+    uint8_t first = record[RECORD_SEQUENCE];
+    uint8_t low = 0; // Slot known to be at or before the head.
+    uint8_t high = SETTINGS_RECORDS; // Slot known to be after the head.
+    while (high - low > 1) {
+        uint8_t slot = (low + high) / 2;
+        if (readRecord(slot, record)
+            && (uint8_t)(record[RECORD_SEQUENCE] - first) == slot)
+            low = slot;
+        else
+            high = slot;
+    }
+    head = low;
+    headSequence = first + low;
+}
+
+/* initSettings()
+ * --------------
+ * Finds the newest value of every setting in the settings journal. The head
+ * of the journal is found by findHead(), then records are read back from the
+ * head only until every setting is found. Settings with no record keep the
+ * value stored at their fixed address before the journal was used, until
+ * moveSettings() is called.
+ */
+void initSettings(void)
+{
+    uint8_t record[RECORD_LENGTH];
+
+    findHead();
+
+    values[SETTING_BRIGHTNESS] = eepromRead(BRIGHTNESS_ADDRESS);
+    values[SETTING_AUTO_BRIGHTNESS] = eepromRead(AUTOBRIGHT_ADDRESS);
+    values[SETTING_INITIAL_DELAY] = (eepromRead(INIT_REPEAT_DELAY_ADDRESS) << 8)
+        | eepromRead(INIT_REPEAT_DELAY_ADDRESS + 1);
+    values[SETTING_REPEAT_RATE] = (eepromRead(REPEAT_RATE_ADDRESS) << 8)
+        | eepromRead(REPEAT_RATE_ADDRESS + 1);
+
+    // Read back from the head until every setting has been found.
+    uint8_t found = 0;
+    for (uint8_t i = 0; i < SETTINGS; i++)
+        newestSlot[i] = NO_RECORD;
+    for (uint8_t i = 0; i < SETTINGS_RECORDS && found < SETTINGS; i++) {
+        uint8_t slot = (head + SETTINGS_RECORDS - i) % SETTINGS_RECORDS;
+        if (!readRecord(slot, record))
+            continue;
+        uint8_t setting = record[RECORD_SETTING];
+        if (newestSlot[setting] != NO_RECORD)
+            continue;
+        newestSlot[setting] = slot;
+        values[setting] = (record[RECORD_VALUE] << 8) | record[RECORD_VALUE + 1];
+        found++;
+    }
+}
+
+/* moveSettings()
+ * --------------
+ * Writes a record for every setting with no record in the journal, so the
+ * fixed address it was read from can be reused. Must be called with
+ * interrupts enabled, as it can wait for EEPROM writes.
+ */
+void moveSettings(void)
+{
+    for (uint8_t i = 0; i < SETTINGS; i++) {
+        if (newestSlot[i] == NO_RECORD)
+            appendRecord(i, values[i]);
+    }
+}
+
+/* getSetting()
+ * ------------
+ * Gets the value of a setting.
+ *
+ * setting: the setting to get.
+ *
+ * Returns: the newest value of the setting.
+ */
+uint16_t getSetting(uint8_t setting)
+{
+    return values[setting];
+}
+
+/* storeSetting()
+ * --------------
+ * Stores a new value of a setting as a record after the head of the settings
+ * journal, so writes are spread over the whole journal instead of wearing out
+ * one EEPROM cell.
+ *
+ * setting: the setting to store.
+ * value: the new value of the setting.
+ */
+void storeSetting(uint8_t setting, uint16_t value)
+{
+    if (values[setting] == value)
+        return;
+    values[setting] = value;
+    appendRecord(setting, value);
+}
@@ -0,0 +1,28 @@
+/*
+ * settings.h
+ *
+ * Team 01 ENGG2800
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Settings kept in the settings journal.
+#define SETTING_BRIGHTNESS 0
+#define SETTING_AUTO_BRIGHTNESS 1
+#define SETTING_INITIAL_DELAY 2
+#define SETTING_REPEAT_RATE 3
+#define SETTINGS 4 // Number of settings.
+
+// Finds the newest value of every setting in the settings journal.
+void initSettings(void);
+
+// Writes a record for every setting still read from its old fixed address.
+void moveSettings(void);
+
+// Returns the value of a setting.
+uint16_t getSetting(uint8_t setting);
+
+// Stores a new value of a setting in the settings journal.
+void storeSetting(uint8_t setting, uint16_t value);
\ No newline at end of file
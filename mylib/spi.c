@@ -0,0 +1,179 @@
+/*
+ * spi.c
+ *
+ * Team 01 ENGG2800
+ */
+
+#include "spi.h"
+#include "hal.h"
+#include <stddef.h>
+
+// SPI clock settings for each device.
+struct SpiClock {
+    uint8_t spcr; // SPR1 and SPR0 bits of SPCR.
+    uint8_t spsr; // SPI2X bit of SPSR.
+};
+
+// The LCD runs at fclk/2, seeeduino must be run at fclk/16 to avoid damaging
+// it.
+static const struct SpiClock clocks[SPI_DEVICES] = {
+    [SPI_LCD] = { .spcr = 0, .spsr = (1 << SPI2X) },
+    [SPI_HID] = { .spcr = (1 << SPR0), .spsr = 0 },
+};
+
+// Device that owns the bus and a bitmap of devices waiting for it.
+static volatile uint8_t owner = SPI_NONE;
+static volatile uint8_t waiting;
+
+// Functions to call when a waiting device is given the bus.
+static void (*volatile startTransfer[SPI_DEVICES])(void);
+
+// Bytes left to send by spiTransmit().
+static const uint8_t* volatile transmitData;
+static volatile uint8_t transmitLength;
+static void (*volatile transmitDone)(void);
+
+/* grant()
+ * -------
+ * Gives the bus to a device and sets the SPI clock for it. Must be called with
+ * interrupts disabled.
+ *
+ * device: the device to give the bus to.
+ */
+static void grant(uint8_t device)
+{
+    owner = device;
+    waiting &= ~(1 << device);
+
+    SPCR = (SPCR & ~((1 << SPIE) | (1 << SPR1) | (1 << SPR0)))
+        | clocks[device].spcr;
+    SPSR = (SPSR & ~(1 << SPI2X)) | clocks[device].spsr;
+}
+
+/* spiAcquire()
+ * ------------
+ * Waits until the SPI bus is free and claims it for the device. Only used
+ * from the main program, the wait is at most one transfer of another device.
+ *
+ * device: the device claiming the bus.
+ */
+void spiAcquire(uint8_t device)
+{
+    // The bus is handed over by spiRelease() when the owner finishes.
+    uint8_t claimed = 0;
+    while (!claimed) {
+        uint8_t sreg = SREG;
+        cli();
+        if (owner == SPI_NONE) {
+            grant(device);
+        } else if (owner != device) {
+            startTransfer[device] = NULL;
+            waiting |= (1 << device);
+        }
+        claimed = owner == device;
+        SREG = sreg;
+    }
+}
+
+/* spiRequest()
+ * ------------
+ * Claims the SPI bus for the device without waiting. The start function is
+ * called straight away if the bus is free, otherwise when it is released.
+ *
+ * device: the device claiming the bus.
+ * start: the function that starts the transfer.
+ */
+void spiRequest(uint8_t device, void (*start)(void))
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t granted = owner == SPI_NONE;
+    if (granted) {
+        grant(device);
+    } else {
+        startTransfer[device] = start;
+        waiting |= (1 << device);
+    }
+    SREG = sreg;
+
+    if (granted)
+        start();
+}
+
+/* spiRelease()
+ * ------------
+ * Releases the SPI bus. Waiting devices are served round robin starting with
+ * the device after the current owner, so no device can hold out the others.
+ */
+void spiRelease(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t next = SPI_NONE;
+    for (uint8_t i = 1; i <= SPI_DEVICES; i++) {
+        uint8_t device = (owner + i) % SPI_DEVICES;
+        if (waiting & (1 << device)) {
+            next = device;
+            break;
+        }
+    }
+
+    void (*start)(void) = NULL;
+    owner = SPI_NONE;
+    if (next != SPI_NONE) {
+        grant(next);
+        start = startTransfer[next];
+    }
+    SREG = sreg;
+
+    if (start)
+        start();
+}
+
+/* spiYield()
+ * ----------
+ * Lets a waiting device use the SPI bus between parts of a long transfer, then
+ * claims the bus again for the current owner.
+ */
+void spiYield(void)
+{
+    uint8_t device = owner;
+    if (!waiting || device == SPI_NONE)
+        return;
+
+    spiRelease();
+    spiAcquire(device);
+}
+
+/* spiTransmit()
+ * -------------
+ * Sends bytes through SPI from the SPI transfer complete interrupt, so the
+ * CPU is free while they are sent. The caller must own the bus and keep the
+ * data unchanged until done is called.
+ *
+ * data: a pointer to the bytes to send.
+ * length: the number of bytes to send, at least 1.
+ * done: the function called from the interrupt after the last byte.
+ */
+void spiTransmit(const uint8_t* data, uint8_t length, void (*done)(void))
+{
+    transmitData = data + 1;
+    transmitLength = length - 1;
+    transmitDone = done;
+
+    SPCR |= (1 << SPIE);
+    SPDR = data[0];
+}
+
+// Send the next byte of spiTransmit() when the previous one has been sent.
+ISR(SPI_STC_vect)
+{
+    if (transmitLength) {
+        transmitLength--;
+        SPDR = *transmitData++;
+        return;
+    }
+
+    SPCR &= ~(1 << SPIE);
+    transmitDone();
+}
\ No newline at end of file
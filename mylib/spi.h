@@ -0,0 +1,29 @@
+/*
+ * spi.h
+ *
+ * Team 01 ENGG2800
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define SPI_LCD 0 // Device number of the LCD.
+#define SPI_HID 1 // Device number of seeeduino.
+#define SPI_DEVICES 2 // Number of devices on the SPI bus.
+#define SPI_NONE 0xFF // Owner of the SPI bus when it is free.
+
+// Waits until the SPI bus is free and claims it for the device.
+void spiAcquire(uint8_t device);
+
+// Claims the SPI bus for the device and calls start once it has the bus.
+void spiRequest(uint8_t device, void (*start)(void));
+
+// Releases the SPI bus and hands it to the next waiting device.
+void spiRelease(void);
+
+// Releases the SPI bus if another device is waiting and claims it again.
+void spiYield(void);
+
+// Sends bytes through SPI in the background and calls done when finished.
+void spiTransmit(const uint8_t* data, uint8_t length, void (*done)(void));
\ No newline at end of file
@@ -24,9 +24,7 @@
 
 #define F_CPU 11059200L
 
-#include <avr/io.h>
-#include <avr/pgmspace.h>
-#include <util/delay.h>
+#include "hal.h"
 #include "font.h"
 #include "st7735.h"
 
@@ -288,6 +286,81 @@ uint8_t ST7735_Data16BitsSend (struct st7735 * lcd, uint16_t data)
   return SPDR;
 }
 
+/**
+ * @desc    Stream start - send command and keep chip enabled for its data,
+ *          the data bytes then follow back to back without toggling CS or DC
+ *
+ * @param   struct st7735 * lcd
+ * @param   uint8_t command
+ *
+ * @return  void
+ */
+void ST7735_StreamStart (struct st7735 * lcd, uint8_t command)
+{
+  // chip enable - active low
+  CLR_BIT (*(lcd->cs->port), lcd->cs->pin);
+  // command (active low)
+  CLR_BIT (*(lcd->dc->port), lcd->dc->pin);
+  // transmitting command
+  SPDR = command;
+  // wait till command transmit, SPIF stays set for first data byte
+  WAIT_UNTIL_BIT_IS_SET (SPSR, SPIF);
+  // data (active high)
+  SET_BIT (*(lcd->dc->port), lcd->dc->pin);
+}
+
+/**
+ * @desc    Stream 8bits data - wait for previous byte and start the next one,
+ *          returns while the byte shifts out so the caller can prepare another
+ *
+ * @param   uint8_t
+ *
+ * @return  void
+ */
+void ST7735_Stream8Bits (uint8_t data)
+{
+  // wait till previous byte transmit
+  WAIT_UNTIL_BIT_IS_SET (SPSR, SPIF);
+  // transmitting data, clears SPIF
+  SPDR = data;
+}
+
+/**
+ * @desc    Stream 16bits data
+ *
+ * @param   uint16_t
+ *
+ * @return  void
+ */
+void ST7735_Stream16Bits (uint16_t data)
+{
+  // wait till previous byte transmit
+  WAIT_UNTIL_BIT_IS_SET (SPSR, SPIF);
+  // transmitting data high byte
+  SPDR = (uint8_t) (data >> 8);
+  // wait till high byte transmit
+  WAIT_UNTIL_BIT_IS_SET (SPSR, SPIF);
+  // transmitting data low byte
+  SPDR = (uint8_t) (data);
+}
+
+/**
+ * @desc    Stream end - wait for last byte and disable chip
+ *
+ * @param   struct st7735 * lcd
+ *
+ * @return  uint8_t
+ */
+uint8_t ST7735_StreamEnd (struct st7735 * lcd)
+{
+  // wait till last byte transmit
+  WAIT_UNTIL_BIT_IS_SET (SPSR, SPIF);
+  // chip disable - idle high
+  SET_BIT (*(lcd->cs->port), lcd->cs->pin);
+  // return received data, clears SPIF
+  return SPDR;
+}
+
 /**
  * @desc    Set window
  *
@@ -310,18 +383,22 @@ uint8_t ST7735_SetWindow (struct st7735 * lcd, uint8_t x0, uint8_t x1, uint8_t y
     return ST7735_ERROR;
   }  
   // column address set
-  ST7735_CommandSend (lcd, CASET);
+  ST7735_StreamStart (lcd, CASET);
   // send start x position
-  ST7735_Data16BitsSend (lcd, 0x0000 | x0);
+  ST7735_Stream16Bits (0x0000 | x0);
   // send end x position
-  ST7735_Data16BitsSend (lcd, 0x0000 | x1);
+  ST7735_Stream16Bits (0x0000 | x1);
+  // end of column address
+  ST7735_StreamEnd (lcd);
 
   // row address set
-  ST7735_CommandSend (lcd, RASET);
+  ST7735_StreamStart (lcd, RASET);
   // send start y position
-  ST7735_Data16BitsSend (lcd, 0x0000 | y0);
+  ST7735_Stream16Bits (0x0000 | y0);
   // send end y position
-  ST7735_Data16BitsSend (lcd, 0x0000 | y1);
+  ST7735_Stream16Bits (0x0000 | y1);
+  // end of row address
+  ST7735_StreamEnd (lcd);
 
   // success
   return ST7735_SUCCESS;
@@ -339,12 +416,14 @@ uint8_t ST7735_SetWindow (struct st7735 * lcd, uint8_t x0, uint8_t x1, uint8_t y
 void ST7735_SendColor565 (struct st7735 * lcd, uint16_t color, uint16_t count)
 {
   // access to RAM
-  ST7735_CommandSend (lcd, RAMWR);
+  ST7735_StreamStart (lcd, RAMWR);
   // counter
   while (count--) {
     // write color
-    ST7735_Data16BitsSend (lcd, color);
+    ST7735_Stream16Bits (color);
   }
+  // end of pixels
+  ST7735_StreamEnd (lcd);
 }
 
 /**
@@ -408,107 +487,81 @@ void ST7735_ClearScreen (struct st7735 * lcd, uint16_t color)
 }
 
 /**
- * @desc    Draw character
+ * @desc    Draw character - the whole character cell including the space
+ *          after it is one window, streamed in one burst of foreground
+ *          and background pixels
  *
  * @param   struct st7735 *
  * @param   char character
  * @param   uint16_t color
+ * @param   uint16_t background color
  * @param   enum Size (X1, X2, X3)
  *
  * @return  void
  */
-char ST7735_DrawChar (struct st7735 * lcd, char character, uint16_t color, enum Size size)
+char ST7735_DrawChar (struct st7735 * lcd, char character, uint16_t color, uint16_t background, enum Size size)
 {
   // variables
-  uint8_t letter, idxCol, idxRow;
+  uint8_t letter[CHARS_COLS_LEN];
+  uint8_t idxCol, idxRow;
+  uint8_t xe, ye;
+  // 2x wider font (X3)
+  uint8_t wide = size & 0x01;
+  // 2x higher font (X2, X3)
+  uint8_t high = size >> 7;
+  // cell width including space after character
+  uint8_t width = (CHARS_COLS_LEN << wide) + 1;
+  // cell height
+  uint8_t height = CHARS_ROWS_LEN << high;
+
   // check if character is out of range
   if ((character < 0x20) &&
       (character > 0x7f)) { 
     // out of range
     return 0;
   }
-  // last column of character array - 5 columns 
-  idxCol = CHARS_COLS_LEN;
-  // last row of character array - 8 rows / bits
-  idxRow = CHARS_ROWS_LEN;
-
-  // --------------------------------------
-  // SIZE X1 - normal font 1x high, 1x wide
-  // --------------------------------------
-  if (size == X1) {  
-    // loop through 5 bits
-    while (idxCol--) {
-      // read from ROM memory 
-      letter = pgm_read_byte (&FONTS[character - 32][idxCol]);
-      // loop through 8 bits
-      while (idxRow--) {
-        // check if bit set
-        if (letter & (1 << idxRow)) {
-          // draw pixel 
-          ST7735_DrawPixel (lcd, cacheMemIndexCol + idxCol, cacheMemIndexRow + idxRow, color);
-        }
-      }
-      // fill index row again
-      idxRow = CHARS_ROWS_LEN;
-    }
-    // update x position
-    cacheMemIndexCol = cacheMemIndexCol + CHARS_COLS_LEN + 1;
-  
-  // --------------------------------------
-  // SIZE X2 - font 2x higher, normal wide
-  // --------------------------------------
-  } else if (size == X2) {
-    // loop through 5 bytes
-    while (idxCol--) {
-      // read from ROM memory 
-      letter = pgm_read_byte (&FONTS[character - 32][idxCol]);
-      // loop through 8 bits
-      while (idxRow--) {
-        // check if bit set
-        if (letter & (1 << idxRow)) {
-          // draw first left up pixel; 
-          // (idxRow << 1) - 2x multiplied 
-          ST7735_DrawPixel (lcd, cacheMemIndexCol + idxCol, cacheMemIndexRow + (idxRow << 1), color);
-          // draw second left down pixel
-          ST7735_DrawPixel (lcd, cacheMemIndexCol + idxCol, cacheMemIndexRow + (idxRow << 1) + 1, color);
-        }
-      }
-      // fill index row again
-      idxRow = CHARS_ROWS_LEN;
-    }
-    // update x position
-    cacheMemIndexCol = cacheMemIndexCol + CHARS_COLS_LEN + 1;
+  // check if cell starts off screen
+  if ((cacheMemIndexCol > SIZE_X) ||
+      (cacheMemIndexRow > SIZE_Y)) {
+    // out of range
+    return ST7735_ERROR;
+  }
+  // last column of cell, clipped to screen
+  xe = (cacheMemIndexCol + width - 1 > SIZE_X) ? SIZE_X : cacheMemIndexCol + width - 1;
+  // last row of cell, clipped to screen
+  ye = (cacheMemIndexRow + height - 1 > SIZE_Y) ? SIZE_Y : cacheMemIndexRow + height - 1;
+
+  // read columns from ROM memory
+  for (idxCol = 0; idxCol < CHARS_COLS_LEN; idxCol++) {
+    // one byte per column, bit 0 on top
+    letter[idxCol] = pgm_read_byte (&FONTS[character - 32][idxCol]);
+  }
 
-  // --------------------------------------
-  // SIZE X3 - font 2x higher, 2x wider
-  // --------------------------------------
-  } else if (size == X3) {
-    // loop through 5 bytes
-    while (idxCol--) {
-      // read from ROM memory 
-      letter = pgm_read_byte (&FONTS[character - 32][idxCol]);
-      // loop through 8 bits
-      while (idxRow--) {
-        // check if bit set
-        if (letter & (1 << idxRow)) {
-          // draw first left up pixel; 
-          // (idxRow << 1) - 2x multiplied 
-          ST7735_DrawPixel (lcd, cacheMemIndexCol + (idxCol << 1), cacheMemIndexRow + (idxRow << 1), color);
-          // draw second left down pixel
-          ST7735_DrawPixel (lcd, cacheMemIndexCol + (idxCol << 1), cacheMemIndexRow + (idxRow << 1) + 1, color);
-          // draw third right up pixel
-          ST7735_DrawPixel (lcd, cacheMemIndexCol + (idxCol << 1) + 1, cacheMemIndexRow + (idxRow << 1), color);
-          // draw fourth right down pixel
-          ST7735_DrawPixel (lcd, cacheMemIndexCol + (idxCol << 1) + 1, cacheMemIndexRow + (idxRow << 1) + 1, color);
-        }
+  // set window of cell
+  ST7735_SetWindow (lcd, cacheMemIndexCol, xe, cacheMemIndexRow, ye);
+  // access to RAM
+  ST7735_StreamStart (lcd, RAMWR);
+  // loop through rows of cell
+  for (idxRow = 0; idxRow <= ye - cacheMemIndexRow; idxRow++) {
+    // loop through columns of cell
+    for (idxCol = 0; idxCol <= xe - cacheMemIndexCol; idxCol++) {
+      // column of character, space after it is background
+      uint8_t column = idxCol >> wide;
+      // check if bit set
+      if ((column < CHARS_COLS_LEN) && (letter[column] & (1 << (idxRow >> high)))) {
+        // foreground pixel
+        ST7735_Stream16Bits (color);
+      } else {
+        // background pixel
+        ST7735_Stream16Bits (background);
       }
-      // fill index row again
-      idxRow = CHARS_ROWS_LEN;
     }
-
-    // update x position
-    cacheMemIndexCol = cacheMemIndexCol + CHARS_COLS_LEN + CHARS_COLS_LEN + 1;
   }
+  // end of pixels
+  ST7735_StreamEnd (lcd);
+
+  // update x position
+  cacheMemIndexCol = cacheMemIndexCol + width;
 
   // return exit
   return ST7735_SUCCESS;
@@ -579,11 +632,12 @@ char ST7735_CheckPosition (unsigned char x, unsigned char y, unsigned char max_y
  * @param   struct st7735 *
  * @param   char * string 
  * @param   uint16_t color
+ * @param   uint16_t background color
  * @param   enum Size (X1, X2, X3)
  *
  * @return  void
  */
-void ST7735_DrawString (struct st7735 * lcd, char *str, uint16_t color, enum Size size)
+void ST7735_DrawString (struct st7735 * lcd, char *str, uint16_t color, uint16_t background, enum Size size)
 {
   // variables
   unsigned int i = 0;
@@ -608,7 +662,7 @@ void ST7735_DrawString (struct st7735 * lcd, char *str, uint16_t color, enum Siz
     // update position
     if (ST7735_SUCCESS == check) {
       // read characters and increment index
-      ST7735_DrawChar (lcd, str[i++], color, size);
+      ST7735_DrawChar (lcd, str[i++], color, background, size);
     }
   }
 }
@@ -22,7 +22,7 @@
  *              http://w8bh.net/avr/AvrTFT.pdf
  */
 
-#include <avr/pgmspace.h>
+#include "hal.h"
 
 #ifndef __ST7735_H__
 #define __ST7735_H__
@@ -124,9 +124,9 @@
   /** @const Command list ST7735B */
   extern const uint8_t INIT_ST7735B[];
   /** @var array Chache memory char index row */
-  unsigned short int cacheMemIndexRow;
+  extern unsigned short int cacheMemIndexRow;
   /** @var array Chache memory char index column */
-  unsigned short int cacheMemIndexCol;
+  extern unsigned short int cacheMemIndexCol;
 
   /** @enum Font sizes */
   enum Size {
@@ -238,6 +238,43 @@
    */
   uint8_t ST7735_Data16BitsSend (struct st7735 *, uint16_t);
 
+  /**
+   * @desc    Stream start
+   *
+   * @param   struct st7735 *
+   * @param   uint8_t
+   *
+   * @return  void
+   */
+  void ST7735_StreamStart (struct st7735 *, uint8_t);
+
+  /**
+   * @desc    Stream 8bits data
+   *
+   * @param   uint8_t
+   *
+   * @return  void
+   */
+  void ST7735_Stream8Bits (uint8_t);
+
+  /**
+   * @desc    Stream 16bits data
+   *
+   * @param   uint16_t
+   *
+   * @return  void
+   */
+  void ST7735_Stream16Bits (uint16_t);
+
+  /**
+   * @desc    Stream end
+   *
+   * @param   struct st7735 *
+   *
+   * @return  uint8_t
+   */
+  uint8_t ST7735_StreamEnd (struct st7735 *);
+
   /**
    * @desc    Set window
    *
@@ -338,11 +375,12 @@
    * @param   struct st7735 *
    * @param   char
    * @param   uint16_t
+   * @param   uint16_t
    * @param   enum Size (X1, X2, X3)
    *
    * @return  void
    */
-  char ST7735_DrawChar (struct st7735 *, char, uint16_t, enum Size);
+  char ST7735_DrawChar (struct st7735 *, char, uint16_t, uint16_t, enum Size);
 
   /**
    * @desc    Draw string
@@ -350,11 +388,12 @@
    * @param   struct st7735 *
    * @param   char *
    * @param   uint16_t
+   * @param   uint16_t
    * @param   enum Size (X1, X2, X3)
 
    * @return void
    */
-  void ST7735_DrawString (struct st7735 *, char *, uint16_t, enum Size);
+  void ST7735_DrawString (struct st7735 *, char *, uint16_t, uint16_t, enum Size);
 
   /**
    * @desc    Draw line
@@ -5,9 +5,8 @@
  */
 
 #include "timer.h"
-#include <avr/common.h>
-#include <avr/interrupt.h>
-#include <avr/io.h>
+#include "hal.h"
+#include "keypad.h"
 
 // Initialise variable that stores current time in ms
 uint32_t currentTime;
@@ -75,8 +74,11 @@ uint32_t getCurrentTime(void)
     return time;
 }
 
-// Add 1ms to currentTime whenever timer 0 is cleared.
+// Add 1ms to currentTime whenever timer 0 is cleared and scan the keypad in
+// the background so key presses are not missed while the main loop is busy.
 ISR(TIMER0_COMPA_vect)
 {
     currentTime++;
+    if (!(currentTime % SCAN_INTERVAL))
+        keyScan();
 }
\ No newline at end of file
@@ -6,8 +6,13 @@
 
 #include "usart.h"
 #include "timer.h"
-#include <avr/interrupt.h>
-#include <avr/io.h>
+#include "hal.h"
+
+// Ring buffer of bytes waiting to be sent. Bytes are added by the main program
+// and sent by the USART data register empty interrupt.
+static uint8_t transmitBuffer[TRANSMIT_BUFFER];
+static volatile uint8_t transmitHead;
+static volatile uint8_t transmitTail;
 
 /* usartInit()
  * -----------
@@ -25,19 +30,44 @@ void usartInit(uint8_t ubrr)
 
     // Set frame format to 8 bits and 1 stop bit.
     UCSR0C |= (1 << UCSZ01) | (1 << UCSZ00);
+
+    // Idle sleep keeps the USART and timers running while waiting for space
+    // in the transmit buffer.
+    set_sleep_mode(SLEEP_MODE_IDLE);
 }
 
 /* usartTransmit()
  * ---------------
- * Sends a byte through USART.
+ * Queues a byte to be sent through USART. Returns straight away unless the
+ * ring buffer is full, in which case it waits with interrupts enabled for the
+ * interrupt to make space. Must only be called from the main program.
  *
  * data: the byte to send.
  */
 void usartTransmit(uint8_t data)
 {
-    // Wait for transmit buffer to empty.
-    while (!(UCSR0A & (1 << UDRE0))) { }
+    uint8_t next = (transmitHead + 1) % TRANSMIT_BUFFER;
+
+    // Sleep until the interrupt has made space in the ring buffer.
+    while (next == transmitTail) {
+        sleep_mode();
+    }
+
+    transmitBuffer[transmitHead] = data;
+    transmitHead = next;
+
+    // Enable the interrupt to send the byte.
+    UCSR0B |= (1 << UDRIE0);
+}
+
+// Send the next byte in the ring buffer when the data register is empty.
+ISR(USART_UDRE_vect)
+{
+    if (transmitHead == transmitTail) {
+        UCSR0B &= ~(1 << UDRIE0);
+        return;
+    }
 
-    // Send the data.
-    UDR0 = data;
+    UDR0 = transmitBuffer[transmitTail];
+    transmitTail = (transmitTail + 1) % TRANSMIT_BUFFER;
 }
@@ -9,11 +9,10 @@
 #include <stdint.h>
 
 #define UBRR 5 // Baud rate register value
-#define RECEIVE_BUFFER 770 // Max buffer for bytes received through USART.
-#define NUMBER_BUFFER 10 // Buffer for converting brightness level to number.
+#define TRANSMIT_BUFFER 64 // Size of ring buffer for bytes to send via USART.
 
 // Initialises USART with the specified UBRR value.
 void usartInit(uint8_t ubrr);
 
-// Sends a byte through USART.
+// Queues a byte to be sent through USART in the background.
 void usartTransmit(uint8_t data);
\ No newline at end of file